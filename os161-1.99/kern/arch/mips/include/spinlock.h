@@ -43,6 +43,8 @@ typedef unsigned spinlock_data_t;
 void spinlock_data_set(volatile spinlock_data_t *sd, unsigned val);
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+spinlock_data_t spinlock_data_fetchadd(volatile spinlock_data_t *sd,
+				       unsigned val);
 
 ////////////////////////////////////////////////////////////
 
@@ -93,5 +95,32 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchadd(volatile spinlock_data_t *sd, unsigned val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	/*
+	 * Fetch-and-add using LL/SC: load the existing value into
+	 * X, and try to store X + VAL. Unlike test-and-set, the
+	 * caller can't just try again later, so retry here until
+	 * the SC succeeds.
+	 */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *sd */
+			"addu %1, %0, %3;"	/*   y = x + val */
+			"sc %1, 0(%2);"		/*   *sd = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (sd), "r" (val));
+	} while (y == 0);
+	return x;
+}
+
 
 #endif /* _MIPS_SPINLOCK_H_ */
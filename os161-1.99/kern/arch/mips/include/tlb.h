@@ -60,6 +60,15 @@ void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
+/*
+ * tlb_setasid: load ENTRYHI (only its PID field matters) into the
+ *        entryhi register, making that PID the current address space
+ *        ID. Note that all of the functions above leave entryhi set to
+ *        whatever they were passed (tlb_read: to what it read), so
+ *        code that uses ASIDs must pass the current one or reload it.
+ */
+void tlb_setasid(uint32_t entryhi);
+
 /*
  * TLB entry fields.
  *
@@ -78,7 +87,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PID_SHIFT 6
+
+/* Number of distinct address space IDs */
+#define NUM_ASID 64
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
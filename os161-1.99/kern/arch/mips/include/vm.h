@@ -113,7 +113,8 @@ struct tlbshootdown {
 	 * Change this to what you need for your VM design.
 	 */
 	struct addrspace *ts_addrspace;
-	vaddr_t ts_vaddr;
+	vaddr_t ts_vaddr;		/* entryhi, with the ASID */
+	struct semaphore *ts_done;	/* V'd once the mapping is gone */
 };
 
 #define TLBSHOOTDOWN_MAX 16
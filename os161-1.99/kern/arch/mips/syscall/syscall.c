@@ -39,7 +39,16 @@
 #include "opt-A2.h"
 #if OPT_A2
 #include <addrspace.h>
+#include <copyinout.h>
 #endif /* OPT_A2*/
+#include "opt-A3.h"
+#if OPT_A3
+#include <kmem.h>
+
+struct kmem_cache trapframe_cache =
+	KMEM_CACHE_INITIALIZER("trapframe", sizeof(struct trapframe));
+#endif /* OPT_A3 */
+
 /*
  * System call dispatcher.
  *
@@ -84,6 +93,19 @@ syscall(struct trapframe *tf)
 	int callno;
 	int32_t retval;
 	int err;
+#if OPT_A2
+	int32_t retval_lo;	/* low half of a 64-bit result, in v1 */
+	off_t pos;
+	int whence;
+#endif /* OPT_A2*/
+#if OPT_A3
+	/* mmap's last two arguments are on the stack, padded to 8 bytes */
+	struct {
+		int32_t fd;
+		int32_t pad;
+		off_t offset;
+	} mmapargs;
+#endif /* OPT_A3 */
 
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
@@ -101,6 +123,9 @@ syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
+#if OPT_A2
+	retval_lo = 0;
+#endif /* OPT_A2*/
 
 	switch (callno) {
 	    case SYS_reboot:
@@ -144,8 +169,120 @@ syscall(struct trapframe *tf)
 	  /* execv access parameters using argc and argv, which are got by 'enter_new_process'.*/
 	  err = sys_execv((char *)tf->tf_a0, (char **)tf->tf_a1);
 	  break;
+
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (mode_t)tf->tf_a2,
+			 (int *)&retval);
+	  break;
+
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)&retval);
+	  break;
+
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+
+	case SYS_lseek:
+	  /* the offset is in the aligned pair a2/a3, whence on the stack */
+	  pos = ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3;
+	  err = copyin((const_userptr_t)(tf->tf_sp + 16), &whence, sizeof(int));
+	  if (err) {
+	    break;
+	  }
+	  err = sys_lseek((int)tf->tf_a0, pos, whence, &pos);
+	  retval = (int32_t)(pos >> 32);
+	  retval_lo = (int32_t)pos;
+	  break;
+
+	case SYS_dup2:
+	  err = sys_dup2((int)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int *)&retval);
+	  break;
+
+	case SYS_pread:
+	case SYS_pwrite:
+	  /* the offset doesn't fit in a3, so it's on the stack */
+	  err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos, sizeof(off_t));
+	  if (err) {
+	    break;
+	  }
+	  if (callno == SYS_pread) {
+	    err = sys_pread((int)tf->tf_a0,
+			    (userptr_t)tf->tf_a1,
+			    (size_t)tf->tf_a2,
+			    pos,
+			    (int *)&retval);
+	  }
+	  else {
+	    err = sys_pwrite((int)tf->tf_a0,
+			     (userptr_t)tf->tf_a1,
+			     (size_t)tf->tf_a2,
+			     pos,
+			     (int *)&retval);
+	  }
+	  break;
+
+	case SYS_readv:
+	  err = sys_readv((int)tf->tf_a0,
+			  (userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2,
+			  (int *)&retval);
+	  break;
+
+	case SYS_writev:
+	  err = sys_writev((int)tf->tf_a0,
+			   (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2,
+			   (int *)&retval);
+	  break;
+
+	case SYS_sendfile:
+	  err = sys_sendfile((int)tf->tf_a0,
+			     (int)tf->tf_a1,
+			     (userptr_t)tf->tf_a2,
+			     (size_t)tf->tf_a3,
+			     (int *)&retval);
+	  break;
 #endif /* OPT_A2*/
 
+#if OPT_A3
+	case SYS_sbrk:
+	  err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+	  break;
+
+	case SYS_mmap:
+	  err = copyin((const_userptr_t)(tf->tf_sp + 16), &mmapargs,
+		       sizeof(mmapargs));
+	  if (err) {
+	    break;
+	  }
+	  err = sys_mmap((userptr_t)tf->tf_a0,
+			 (size_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int)tf->tf_a3,
+			 mmapargs.fd,
+			 mmapargs.offset,
+			 (vaddr_t *)&retval);
+	  break;
+
+	case SYS_munmap:
+	  err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+	  break;
+
+	case SYS_msync:
+	  err = sys_msync((userptr_t)tf->tf_a0,
+			  (size_t)tf->tf_a1,
+			  (int)tf->tf_a2);
+	  break;
+#endif /* OPT_A3 */
+
 	default:
 	  kprintf("Unknown syscall %d\n", callno);
 	  err = ENOSYS;
@@ -165,6 +302,9 @@ syscall(struct trapframe *tf)
 	else {
 		/* Success. */
 		tf->tf_v0 = retval;
+#if OPT_A2
+		tf->tf_v1 = retval_lo;
+#endif /* OPT_A2*/
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 	
@@ -202,7 +342,11 @@ enter_forked_process(void *data1, unsigned long data2)
 	tf = (struct trapframe*)data1;
 	// same tf for user mode
 	user_tf = *tf;
+#if OPT_A3
+	kmem_cache_free(&trapframe_cache, tf);
+#else
 	kfree(tf);
+#endif /* OPT_A3 */
 	
 	// firstly, modify parent's trapframe's $v0 and $a3
 	// to make child's fork looks success and return 0
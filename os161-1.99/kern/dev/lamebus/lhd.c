@@ -31,11 +31,17 @@
  * LAMEbus hard disk (lhd) driver.
  */
 
+#include "opt-A3.h"
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
 #include <uio.h>
 #include <synch.h>
+#if OPT_A3
+#include <spinlock.h>
+#include <wchan.h>
+#endif
 #include <platform/bus.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -94,6 +100,173 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 	return EAGAIN;
 }
 
+#if OPT_A3
+/*
+ * Request queue.
+ *
+ * A request is a run of adjacent sectors together with a kernel-space
+ * uio, possibly of several iovecs, to move their data through. The
+ * controller does one sector per command through its one-sector
+ * buffer, so the interrupt handler copies each finished sector out of
+ * (or the next one into) that buffer and starts the next command
+ * itself: a run goes through back to back, and so does the next queued
+ * request, without waking anybody in between.
+ *
+ * Requests are served in arrival order, except that a new request for
+ * the sectors right after a queued one, in the same direction, is
+ * merged into that one's run: it goes straight behind it, so the two
+ * go through as one stretch of adjacent sectors. At most LHD_MAXMERGE
+ * requests make up a run. Each waits on a semaphore of its own, which
+ * the interrupt handler ups when it is done, so only its owner wakes.
+ * The queue, the free semaphores and the device registers are
+ * protected by lh_lock.
+ */
+struct lhd_req {
+	struct uio *r_uio;		/* kernel-space data of the run */
+	uint32_t r_sector;		/* next sector to transfer */
+	uint32_t r_nsect;		/* sectors still to go */
+	bool r_write;
+	unsigned r_runlen;		/* requests in its run, up to it */
+	int r_result;
+	struct semaphore *r_done;	/* upped when it has finished */
+	struct lhd_req *r_next;
+};
+
+/*
+ * Put a request on the queue, merging it into the run of a queued
+ * request it continues. lh_lock held.
+ */
+static
+void
+lhd_enqueue(struct lhd_softc *lh, struct lhd_req *r)
+{
+	struct lhd_req *q;
+
+	for (q = lh->lh_queue; q != NULL; q = q->r_next) {
+		if (q->r_write == r->r_write &&
+		    q->r_sector + q->r_nsect == r->r_sector &&
+		    q->r_runlen < LHD_MAXMERGE) {
+			r->r_runlen = q->r_runlen + 1;
+			r->r_next = q->r_next;
+			q->r_next = r;
+			if (lh->lh_tail == q) {
+				lh->lh_tail = r;
+			}
+			return;
+		}
+	}
+
+	r->r_runlen = 1;
+	r->r_next = NULL;
+	if (lh->lh_tail != NULL) {
+		lh->lh_tail->r_next = r;
+	}
+	else {
+		lh->lh_queue = r;
+	}
+	lh->lh_tail = r;
+}
+
+/*
+ * Start the next sector of the request at the head of the queue, if
+ * there is one. lh_lock held.
+ */
+static
+void
+lhd_start(struct lhd_softc *lh)
+{
+	struct lhd_req *r = lh->lh_queue;
+	uint32_t statval = LHD_WORKING;
+	int result;
+
+	if (r == NULL) {
+		return;
+	}
+
+	if (r->r_write) {
+		/* Kernel-space, so this can neither fail nor sleep. */
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, r->r_uio);
+		KASSERT(result == 0);
+		statval |= LHD_ISWRITE;
+	}
+	lhd_wreg(lh, LHD_REG_SECT, r->r_sector);
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Record that a sector has completed, and keep the device busy.
+ * Returns the request if that finished it. lh_lock held.
+ */
+static
+struct lhd_req *
+lhd_iodone(struct lhd_softc *lh, int err)
+{
+	struct lhd_req *r = lh->lh_queue;
+	int result;
+
+	if (r == NULL) {
+		/* Nothing was in progress; spurious. */
+		return NULL;
+	}
+
+	if (err == 0) {
+		if (!r->r_write) {
+			result = uiomove(lh->lh_buf, LHD_SECTSIZE, r->r_uio);
+			KASSERT(result == 0);
+		}
+		r->r_sector++;
+		r->r_nsect--;
+	}
+
+	if (err == 0 && r->r_nsect > 0) {
+		lhd_start(lh);
+		return NULL;
+	}
+
+	r->r_result = err;
+	lh->lh_queue = r->r_next;
+	if (lh->lh_queue == NULL) {
+		lh->lh_tail = NULL;
+	}
+	lhd_start(lh);
+	return r;
+}
+
+/*
+ * Interrupt handler for lhd.
+ * Read the status register; if an operation finished, clear the status
+ * register, start the next one, and wake up the owner of a request
+ * that is now complete.
+ */
+void
+lhd_irq(void *vlh)
+{
+	struct lhd_softc *lh = vlh;
+	struct lhd_req *finished = NULL;
+	uint32_t val;
+
+	spinlock_acquire(&lh->lh_lock);
+	val = lhd_rdreg(lh, LHD_REG_STAT);
+
+	switch (val & LHD_STATEMASK) {
+	    case LHD_IDLE:
+	    case LHD_WORKING:
+		break;
+	    case LHD_OK:
+	    case LHD_INVSECT:
+	    case LHD_MEDIA:
+		lhd_wreg(lh, LHD_REG_STAT, 0);
+		finished = lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		break;
+	}
+	spinlock_release(&lh->lh_lock);
+
+	/* The owner is waiting on r_done, so the request is still there. */
+	if (finished != NULL) {
+		V(finished->r_done);
+	}
+}
+#else
 /*
  * Record that an I/O has completed: save the result and poke the
  * completion semaphore.
@@ -132,6 +305,8 @@ lhd_irq(void *vlh)
 	}
 }
 
+#endif /* OPT_A3 */
+
 /*
  * Function called when we are open()'d.
  */
@@ -193,6 +368,134 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+#if OPT_A3
+/*
+ * Queue a run of NSECT sectors starting at SECTOR, moving its data
+ * through the kernel-space uio KU, and wait for it to finish.
+ */
+static
+int
+lhd_submit(struct lhd_softc *lh, struct uio *ku, uint32_t sector,
+	   uint32_t nsect)
+{
+	struct lhd_req r;
+
+	KASSERT(ku->uio_segflg == UIO_SYSSPACE);
+
+	r.r_uio = ku;
+	r.r_sector = sector;
+	r.r_nsect = nsect;
+	r.r_write = ku->uio_rw == UIO_WRITE;
+	r.r_result = 0;
+
+	spinlock_acquire(&lh->lh_lock);
+
+	/* Get a semaphore to wait on; if they're all in use, wait for one. */
+	while (lh->lh_nsems == 0) {
+		wchan_lock(lh->lh_wchan);
+		spinlock_release(&lh->lh_lock);
+		wchan_sleep(lh->lh_wchan);
+		spinlock_acquire(&lh->lh_lock);
+	}
+	r.r_done = lh->lh_sems[--lh->lh_nsems];
+
+	lhd_enqueue(lh, &r);
+
+	/* If the device was idle, get it going. */
+	if (lh->lh_queue == &r) {
+		lhd_start(lh);
+	}
+	spinlock_release(&lh->lh_lock);
+
+	P(r.r_done);
+
+	spinlock_acquire(&lh->lh_lock);
+	lh->lh_sems[lh->lh_nsems++] = r.r_done;
+	wchan_wakeone(lh->lh_wchan);
+	spinlock_release(&lh->lh_lock);
+
+	return r.r_result;
+}
+
+/*
+ * I/O function (for both reads and writes)
+ *
+ * Kernel buffers go to the device as they are, as one request. The
+ * interrupt handler can't get at a process's memory, so user buffers
+ * are staged through a bounce buffer, LHD_MAXRUN sectors at a time.
+ */
+static
+int
+lhd_io(struct device *d, struct uio *uio)
+{
+	struct lhd_softc *lh = d->d_data;
+
+	uint32_t sector = uio->uio_offset / LHD_SECTSIZE;
+	uint32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
+	uint32_t len = uio->uio_resid / LHD_SECTSIZE;
+	uint32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
+	uint32_t n;
+	struct iovec iov;
+	struct uio ku;
+	char *bounce;
+	int result;
+
+	/* Don't allow I/O that isn't sector-aligned. */
+	if (sectoff != 0 || lenoff != 0) {
+		return EINVAL;
+	}
+
+	/* Don't allow I/O past the end of the disk. */
+	if (sector+len > lh->lh_dev.d_blocks) {
+		return EINVAL;
+	}
+
+	if (len == 0) {
+		return 0;
+	}
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return lhd_submit(lh, uio, sector, len);
+	}
+
+	bounce = kmalloc(LHD_MAXRUN * LHD_SECTSIZE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+
+	result = 0;
+	while (len > 0) {
+		n = len < LHD_MAXRUN ? len : LHD_MAXRUN;
+		uio_kinit(&iov, &ku, bounce, n * LHD_SECTSIZE,
+			  (off_t)sector * LHD_SECTSIZE, uio->uio_rw);
+
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+
+		result = lhd_submit(lh, &ku, sector, n);
+		if (result) {
+			break;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, n * LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
+		}
+
+		sector += n;
+		len -= n;
+	}
+
+	kfree(bounce);
+	return result;
+}
+#else
 /*
  * I/O function (for both reads and writes)
  */
@@ -275,6 +578,8 @@ lhd_io(struct device *d, struct uio *uio)
 	return 0;
 }
 
+#endif /* OPT_A3 */
+
 /*
  * Setup routine called by autoconf.c when an lhd is found.
  */
@@ -289,6 +594,22 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
+#if OPT_A3
+	/* Set up the request queue. */
+	spinlock_init(&lh->lh_lock);
+	lh->lh_queue = NULL;
+	lh->lh_tail = NULL;
+	lh->lh_wchan = wchan_create("lhd");
+	if (lh->lh_wchan == NULL) {
+		return ENOMEM;
+	}
+	for (lh->lh_nsems = 0; lh->lh_nsems < LHD_NWAITERS; lh->lh_nsems++) {
+		lh->lh_sems[lh->lh_nsems] = sem_create("lhd-req", 0);
+		if (lh->lh_sems[lh->lh_nsems] == NULL) {
+			return ENOMEM;
+		}
+	}
+#else
 	/* Create the semaphores. */
 	lh->lh_clear = sem_create("lhd-clear", 1);
 	if (lh->lh_clear == NULL) {
@@ -300,6 +621,7 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 		lh->lh_clear = NULL;
 		return ENOMEM;
 	}
+#endif
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
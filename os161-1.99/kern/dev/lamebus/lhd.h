@@ -30,13 +30,39 @@
 #ifndef _LAMEBUS_LHD_H_
 #define _LAMEBUS_LHD_H_
 
+#include "opt-A3.h"
+
 #include <device.h>
+#if OPT_A3
+#include <spinlock.h>
+#endif
 
 /*
  * Our sector size
  */
 #define LHD_SECTSIZE  512
 
+#if OPT_A3
+/*
+ * Most sectors moved per request when bouncing user buffers
+ */
+#define LHD_MAXRUN    16
+
+/*
+ * Most requests merged into one run of adjacent sectors, so a stream
+ * of sequential I/O can't hold off the rest of the queue for ever
+ */
+#define LHD_MAXMERGE  8
+
+/*
+ * Requests that can be waiting at once; each needs a semaphore
+ */
+#define LHD_NWAITERS  16
+
+struct lhd_req;
+struct semaphore;
+#endif
+
 /*
  * Hardware device data associated with lhd (LAMEbus hard disk)
  */
@@ -51,9 +77,18 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
+#if OPT_A3
+	struct spinlock lh_lock;	/* Protects the queue and registers */
+	struct lhd_req *lh_queue;	/* Head is the one in progress */
+	struct lhd_req *lh_tail;
+	struct semaphore *lh_sems[LHD_NWAITERS]; /* Free request semaphores */
+	unsigned lh_nsems;
+	struct wchan *lh_wchan;		/* Waiters for a free semaphore */
+#else
 	int lh_result;			/* Result from I/O operation */
 	struct semaphore *lh_clear;	/* Synchronization */
 	struct semaphore *lh_done;
+#endif
 
 	struct device lh_dev;		/* VFS device structure */
 };
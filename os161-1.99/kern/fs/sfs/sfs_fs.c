@@ -33,6 +33,8 @@
  * Filesystem-level interface routines.
  */
 
+#include "opt-A3.h"
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
@@ -42,6 +44,9 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#if OPT_A3
+#include <iosched.h>
+#endif
 
 /* Shortcuts for the size macros in kern/sfs.h */
 #define SFS_FS_BITMAPSIZE(sfs)  SFS_BITMAPSIZE((sfs)->sfs_super.sp_nblocks)
@@ -175,6 +180,15 @@ sfs_sync(struct fs *fs)
 		sfs->sfs_superdirty = false;
 	}
 
+#if OPT_A3
+	/* Everything above only went as far as the buffer cache. */
+	result = sfs_bsync(sfs);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+#endif
+
 	vfs_biglock_release();
 	return 0;
 }
@@ -222,8 +236,14 @@ sfs_unmount(struct fs *fs)
 	KASSERT(sfs->sfs_freemapdirty == false);
 
 	/* Once we start nuking stuff we can't fail. */
+#if OPT_A3
+	sfs_binval(sfs);
+#endif
 	vnodearray_destroy(sfs->sfs_vnodes);
 	bitmap_destroy(sfs->sfs_freemap);
+#if OPT_A3
+	iosched_detach(sfs->sfs_device);
+#endif
 	
 	/* The vfs layer takes care of the device for us */
 	(void)sfs->sfs_device;
@@ -282,9 +302,25 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENXIO;
 	}
 
+#if OPT_A3
+	/*
+	 * Block I/O goes straight to the device, except for sfs_bsync,
+	 * which hands its batches of writes to the device's I/O
+	 * scheduler to put in order. Detach it again on failure.
+	 */
+	result = iosched_attach(dev);
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+#endif
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
+#if OPT_A3
+		iosched_detach(dev);
+#endif
 		vfs_biglock_release();
 		return ENOMEM;
 	}
@@ -293,6 +329,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	sfs->sfs_vnodes = vnodearray_create();
 	if (sfs->sfs_vnodes == NULL) {
 		kfree(sfs);
+#if OPT_A3
+		iosched_detach(dev);
+#endif
 		vfs_biglock_release();
 		return ENOMEM;
 	}
@@ -305,6 +344,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (result) {
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
+#if OPT_A3
+		iosched_detach(dev);
+#endif
 		vfs_biglock_release();
 		return result;
 	}
@@ -318,6 +360,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			SFS_MAGIC);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
+#if OPT_A3
+		iosched_detach(dev);
+#endif
 		vfs_biglock_release();
 		return EINVAL;
 	}
@@ -335,6 +380,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	if (sfs->sfs_freemap == NULL) {
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
+#if OPT_A3
+		iosched_detach(dev);
+#endif
 		vfs_biglock_release();
 		return ENOMEM;
 	}
@@ -343,6 +391,9 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		bitmap_destroy(sfs->sfs_freemap);
 		vnodearray_destroy(sfs->sfs_vnodes);
 		kfree(sfs);
+#if OPT_A3
+		iosched_detach(dev);
+#endif
 		vfs_biglock_release();
 		return result;
 	}
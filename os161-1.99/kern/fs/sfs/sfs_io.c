@@ -27,6 +27,8 @@
  * SUCH DAMAGE.
  */
 
+#include "opt-A3.h"
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
@@ -34,6 +36,10 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#if OPT_A3
+#include <coremap.h>
+#include <iosched.h>
+#endif
 
 ////////////////////////////////////////////////////////////
 //
@@ -44,8 +50,22 @@
 // initialized, and so may not use anything from sfs
 // except sfs_device.
 
+#if OPT_A3
+/*
+ * Synchronous block I/O. This goes straight to the device rather than
+ * through the I/O scheduler: every caller holds vfs_biglock for the
+ * whole sfs operation, so there is never a second synchronous request
+ * to put in order with this one, and queueing it would only add a
+ * trip through the worker thread. The scheduler gets sfs_bsync's
+ * batches, which are the only time sfs has many blocks in flight.
+ */
+static
+int
+sfs_devio(struct device *dev, struct uio *uio)
+#else
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+#endif
 {
 	int result;
 	int tries=0;
@@ -57,7 +77,11 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	      uio->uio_offset / SFS_BLOCKSIZE);
 
  retry:
+#if OPT_A3
+	result = dev->d_io(dev, uio);
+#else
 	result = sfs->sfs_device->d_io(sfs->sfs_device, uio);
+#endif
 	if (result == EINVAL) {
 		/*
 		 * This means the sector we requested was out of range,
@@ -86,6 +110,412 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 	return result;
 }
 
+#if OPT_A3
+/*
+ * Buffer cache.
+ *
+ * Every block sfs reads or writes goes through one cache of
+ * SFS_BLOCKSIZE buffers, shared by all mounted volumes and keyed by
+ * (device, block). Buffers are found through a hash table and kept on
+ * an LRU list, most recently used first; a miss reuses the least
+ * recently used buffer nobody has pinned, writing it back first if it
+ * is dirty. Writes only dirty the buffer; sfs_sync pushes them to disk
+ * with sfs_bsync. Everything here is protected by vfs_biglock.
+ *
+ * The cache gets 1/SFS_BUF_RAMFRAC of the coremap's pages and is set
+ * up by the first mount, once the VM system is running.
+ */
+
+struct sfs_buf {
+	struct device *b_dev;		// NULL while the buffer holds nothing
+	uint32_t b_block;
+	bool b_dirty;			// newer than the copy on disk
+	unsigned b_pincount;		// sfs_bread without sfs_brelse yet
+	struct sfs_buf *b_hashnext;
+	struct sfs_buf *b_lruprev;	// towards the most recently used end
+	struct sfs_buf *b_lrunext;
+	char *b_data;
+};
+
+#define SFS_BUF_RAMFRAC		16
+#define SFS_BUF_MIN		32
+#define SFS_BUF_MAX		8192
+#define SFS_BUF_PERPAGE		(PAGE_SIZE / SFS_BLOCKSIZE)
+
+static struct sfs_buf *sfs_bufs;
+static unsigned sfs_nbufs;
+static struct sfs_buf **sfs_bufhash;
+static struct sfs_buf *sfs_buf_mru;
+static struct sfs_buf *sfs_buf_lru;
+
+static
+unsigned
+sfs_buf_hash(struct device *dev, uint32_t block)
+{
+	return ((uintptr_t)dev / sizeof(void *) + block) % sfs_nbufs;
+}
+
+static
+void
+sfs_buf_unlink(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	} else {
+		sfs_buf_mru = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	} else {
+		sfs_buf_lru = b->b_lruprev;
+	}
+}
+
+// make B the most recently used buffer
+static
+void
+sfs_buf_touch(struct sfs_buf *b)
+{
+	sfs_buf_unlink(b);
+	b->b_lruprev = NULL;
+	b->b_lrunext = sfs_buf_mru;
+	if (sfs_buf_mru != NULL) {
+		sfs_buf_mru->b_lruprev = b;
+	} else {
+		sfs_buf_lru = b;
+	}
+	sfs_buf_mru = b;
+}
+
+// make B the first buffer to be reused
+static
+void
+sfs_buf_age(struct sfs_buf *b)
+{
+	sfs_buf_unlink(b);
+	b->b_lrunext = NULL;
+	b->b_lruprev = sfs_buf_lru;
+	if (sfs_buf_lru != NULL) {
+		sfs_buf_lru->b_lrunext = b;
+	} else {
+		sfs_buf_mru = b;
+	}
+	sfs_buf_lru = b;
+}
+
+static
+struct sfs_buf *
+sfs_buf_lookup(struct device *dev, uint32_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = sfs_bufhash[sfs_buf_hash(dev, block)]; b != NULL;
+	     b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+// forget what B holds, which must not be dirty
+static
+void
+sfs_buf_drop(struct sfs_buf *b)
+{
+	struct sfs_buf **bp;
+
+	KASSERT(!b->b_dirty);
+	if (b->b_dev == NULL) {
+		return;
+	}
+	bp = &sfs_bufhash[sfs_buf_hash(b->b_dev, b->b_block)];
+	while (*bp != b) {
+		bp = &(*bp)->b_hashnext;
+	}
+	*bp = b->b_hashnext;
+	b->b_dev = NULL;
+	sfs_buf_age(b);
+}
+
+static
+int
+sfs_buf_write(struct sfs_buf *b)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(b->b_dev != NULL && b->b_dirty);
+	SFSUIO(&iov, &ku, b->b_data, b->b_block, UIO_WRITE);
+	result = sfs_devio(b->b_dev, &ku);
+	if (result) {
+		return result;
+	}
+	b->b_dirty = false;
+	return 0;
+}
+
+static
+int
+sfs_buf_init(void)
+{
+	unsigned i, j, nbufs;
+	char *page = NULL;
+
+	if (sfs_bufs != NULL) {
+		return 0;
+	}
+
+	nbufs = coremap_npages() / SFS_BUF_RAMFRAC * SFS_BUF_PERPAGE;
+	if (nbufs < SFS_BUF_MIN) {
+		nbufs = SFS_BUF_MIN;
+	}
+	if (nbufs > SFS_BUF_MAX) {
+		nbufs = SFS_BUF_MAX;
+	}
+
+	sfs_bufs = kmalloc(nbufs * sizeof(struct sfs_buf));
+	sfs_bufhash = kmalloc(nbufs * sizeof(struct sfs_buf *));
+	if (sfs_bufs == NULL || sfs_bufhash == NULL) {
+		goto fail;
+	}
+
+	for (i=0; i<nbufs; i++) {
+		struct sfs_buf *b = &sfs_bufs[i];
+
+		if (i % SFS_BUF_PERPAGE == 0) {
+			page = kmalloc(PAGE_SIZE);
+			if (page == NULL) {
+				for (j=0; j<i; j+=SFS_BUF_PERPAGE) {
+					kfree(sfs_bufs[j].b_data);
+				}
+				goto fail;
+			}
+		}
+		b->b_data = page + (i % SFS_BUF_PERPAGE) * SFS_BLOCKSIZE;
+		b->b_dev = NULL;
+		b->b_block = 0;
+		b->b_dirty = false;
+		b->b_pincount = 0;
+		b->b_hashnext = NULL;
+		b->b_lruprev = i > 0 ? &sfs_bufs[i-1] : NULL;
+		b->b_lrunext = i < nbufs-1 ? &sfs_bufs[i+1] : NULL;
+		sfs_bufhash[i] = NULL;
+	}
+	sfs_buf_mru = &sfs_bufs[0];
+	sfs_buf_lru = &sfs_bufs[nbufs-1];
+	sfs_nbufs = nbufs;
+	return 0;
+
+ fail:
+	kfree(sfs_bufs);
+	kfree(sfs_bufhash);
+	sfs_bufs = NULL;
+	sfs_bufhash = NULL;
+	return ENOMEM;
+}
+
+/*
+ * Hand back the buffer for BLOCK of SFS, pinned so it stays put until
+ * sfs_brelse. Unless FILL is false, in which case the caller is about
+ * to overwrite all of it, the buffer holds the block's contents.
+ */
+int
+sfs_bread(struct sfs_fs *sfs, uint32_t block, bool fill,
+	  struct sfs_buf **ret)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *b;
+	int result;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	result = sfs_buf_init();
+	if (result) {
+		return result;
+	}
+
+	b = sfs_buf_lookup(dev, block);
+	if (b == NULL) {
+		for (b = sfs_buf_lru; b != NULL; b = b->b_lruprev) {
+			if (b->b_pincount == 0) {
+				break;
+			}
+		}
+		if (b == NULL) {
+			panic("sfs: every buffer is pinned\n");
+		}
+		if (b->b_dirty) {
+			result = sfs_buf_write(b);
+			if (result) {
+				return result;
+			}
+		}
+		sfs_buf_drop(b);
+
+		if (fill) {
+			struct iovec iov;
+			struct uio ku;
+
+			SFSUIO(&iov, &ku, b->b_data, block, UIO_READ);
+			result = sfs_devio(dev, &ku);
+			if (result) {
+				return result;
+			}
+		}
+
+		b->b_dev = dev;
+		b->b_block = block;
+		b->b_hashnext = sfs_bufhash[sfs_buf_hash(dev, block)];
+		sfs_bufhash[sfs_buf_hash(dev, block)] = b;
+	}
+
+	b->b_pincount++;
+	sfs_buf_touch(b);
+	*ret = b;
+	return 0;
+}
+
+void *
+sfs_bdata(struct sfs_buf *b)
+{
+	KASSERT(b->b_pincount > 0);
+	return b->b_data;
+}
+
+void
+sfs_bdirty(struct sfs_buf *b)
+{
+	KASSERT(b->b_pincount > 0);
+	b->b_dirty = true;
+}
+
+void
+sfs_brelse(struct sfs_buf *b)
+{
+	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(b->b_pincount > 0);
+	b->b_pincount--;
+}
+
+/*
+ * Write back every dirty buffer of SFS. They are handed to the I/O
+ * scheduler SFS_SYNC_BATCH at a time, so it can put them in disk order.
+ * A write that fails goes again through sfs_buf_write, which retries.
+ * On an error the rest are still written; the first error is returned.
+ */
+#define SFS_SYNC_BATCH	32
+
+static struct sfs_batchwrite {
+	struct sfs_buf *buf;
+	struct iovec iov;
+	struct uio ku;
+	struct ioreq req;
+} sfs_syncbatch[SFS_SYNC_BATCH];
+
+int
+sfs_bsync(struct sfs_fs *sfs)
+{
+	struct device *dev = sfs->sfs_device;
+	unsigned i, j, n;
+	struct sfs_batchwrite *bw;
+	int result, ret = 0;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	i = 0;
+	while (i < sfs_nbufs) {
+		for (n = 0; i < sfs_nbufs && n < SFS_SYNC_BATCH; i++) {
+			struct sfs_buf *b = &sfs_bufs[i];
+
+			if (b->b_dev == dev && b->b_dirty) {
+				bw = &sfs_syncbatch[n++];
+				bw->buf = b;
+				SFSUIO(&bw->iov, &bw->ku, b->b_data,
+				       b->b_block, UIO_WRITE);
+				iosched_submit(dev, &bw->req, &bw->ku);
+			}
+		}
+
+		for (j = 0; j < n; j++) {
+			struct sfs_buf *b = sfs_syncbatch[j].buf;
+
+			result = iosched_wait(dev, &sfs_syncbatch[j].req);
+			if (result) {
+				result = sfs_buf_write(b);
+			}
+			else {
+				b->b_dirty = false;
+			}
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+	}
+	return ret;
+}
+
+/*
+ * Forget every buffer of SFS, at unmount. They must all have been
+ * written back.
+ */
+void
+sfs_binval(struct sfs_fs *sfs)
+{
+	unsigned i;
+
+	KASSERT(vfs_biglock_do_i_hold());
+
+	for (i=0; i<sfs_nbufs; i++) {
+		struct sfs_buf *b = &sfs_bufs[i];
+
+		if (b->b_dev == sfs->sfs_device) {
+			KASSERT(b->b_pincount == 0);
+			sfs_buf_drop(b);
+		}
+	}
+}
+
+/*
+ * Whole-block I/O against the cache. A write that fails partway
+ * leaves a block that was not cached with partly garbage contents,
+ * so that is thrown away.
+ */
+int
+sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
+{
+	struct sfs_buf *b;
+	bool cached;
+	int result;
+
+	KASSERT(uio->uio_offset % SFS_BLOCKSIZE == 0);
+	KASSERT(uio->uio_resid == SFS_BLOCKSIZE);
+
+	cached = sfs_buf_lookup(sfs->sfs_device,
+				uio->uio_offset / SFS_BLOCKSIZE) != NULL;
+	result = sfs_bread(sfs, uio->uio_offset / SFS_BLOCKSIZE,
+			   uio->uio_rw == UIO_READ, &b);
+	if (result) {
+		return result;
+	}
+
+	result = uiomove(b->b_data, SFS_BLOCKSIZE, uio);
+	if (uio->uio_rw == UIO_WRITE) {
+		if (result == 0 || cached) {
+			b->b_dirty = true;
+		}
+		else {
+			b->b_pincount--;
+			sfs_buf_drop(b);
+			return result;
+		}
+	}
+	sfs_brelse(b);
+	return result;
+}
+#endif /* OPT_A3 */
+
 int
 sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block)
 {
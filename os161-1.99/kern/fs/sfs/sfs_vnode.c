@@ -32,6 +32,8 @@
  *
  * File-level (vnode) interface routines.
  */
+#include "opt-A3.h"
+
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
@@ -146,6 +148,13 @@ int
 sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 uint32_t *diskblock)
 {
+#if OPT_A3
+	/*
+	 * The indirect block, straight out of the buffer cache.
+	 */
+	struct sfs_buf *idb;
+	uint32_t *idbuf;
+#else
 	/*
 	 * I/O buffer for handling indirect blocks.
 	 *
@@ -154,6 +163,7 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	 * not use a static area.
 	 */
 	static uint32_t idbuf[SFS_DBPERIDB];
+#endif
 
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	uint32_t block;
@@ -161,7 +171,9 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	uint32_t idnum, idoff;
 	int result;
 
+#if !OPT_A3
 	KASSERT(sizeof(idbuf)==SFS_BLOCKSIZE);
+#endif
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -248,16 +260,34 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 		sv->sv_dirty = true;
 
 		/* Clear the indirect block buffer */
+#if OPT_A3
+		result = sfs_bread(sfs, idblock, false, &idb);
+		if (result) {
+			return result;
+		}
+		idbuf = sfs_bdata(idb);
+		bzero(idbuf, SFS_BLOCKSIZE);
+		sfs_bdirty(idb);
+#else
 		bzero(idbuf, sizeof(idbuf));
+#endif
 	}
 	else {
 		/*
 		 * We already have an indirect block allocated; load it.
 		 */
+#if OPT_A3
+		result = sfs_bread(sfs, idblock, true, &idb);
+		if (result) {
+			return result;
+		}
+		idbuf = sfs_bdata(idb);
+#else
 		result = sfs_rblock(sfs, idbuf, idblock);
 		if (result) {
 			return result;
 		}
+#endif
 	}
 
 	/* Get the block out of the indirect block buffer */
@@ -267,18 +297,29 @@ sfs_bmap(struct sfs_vnode *sv, uint32_t fileblock, int doalloc,
 	if (block==0 && doalloc) {
 		result = sfs_balloc(sfs, &block);
 		if (result) {
+#if OPT_A3
+			sfs_brelse(idb);
+#endif
 			return result;
 		}
 
 		/* Remember the block we allocated */
 		idbuf[idoff] = block;
 
+#if OPT_A3
+		/* The indirect block is now dirty; sfs_sync writes it back */
+		sfs_bdirty(idb);
+#else
 		/* The indirect block is now dirty; write it back */
 		result = sfs_wblock(sfs, idbuf, idblock);
 		if (result) {
 			return result;
 		}
+#endif
 	}
+#if OPT_A3
+	sfs_brelse(idb);
+#endif
 
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
@@ -636,6 +677,375 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+#if OPT_A3
+/*
+ * In-memory name index for a directory, so that looking up a name, or
+ * finding a free slot for a new one, doesn't read every entry. It is
+ * built the first time sfs_dir_findname needs it, kept up to date by
+ * sfs_dir_link and sfs_dir_unlink (the only things that write
+ * directory entries), and thrown away by sfs_reclaim. Like the rest of
+ * the vnode it is protected by vfs_biglock.
+ *
+ * If there isn't memory to build it or keep it up to date, it is
+ * dropped, and lookups scan the directory until it can be built again.
+ */
+struct sfs_dirent {
+	struct sfs_dirent *de_next;	/* hash chain */
+	uint32_t de_hash;
+	uint32_t de_ino;
+	int de_slot;
+	char de_name[];
+};
+
+struct sfs_dirhash {
+	struct sfs_dirent **dh_buckets;
+	unsigned dh_nbuckets;		/* a power of 2 */
+	unsigned dh_count;		/* names in the index */
+	struct sfs_dirent **dh_slots;	/* by slot; NULL if the slot is free */
+	unsigned dh_nslots;		/* slots in the directory */
+	unsigned dh_maxslots;		/* room in dh_slots */
+	unsigned dh_freehint;		/* no free slot below this one */
+};
+
+#define SFS_DIRHASH_MINBUCKETS	16
+/* entries read at a time to build the index: a block's worth */
+#define SFS_DIRHASH_BATCH	(SFS_BLOCKSIZE / sizeof(struct sfs_dir))
+
+/* FNV-1a */
+static
+uint32_t
+sfs_namehash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name) {
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	}
+	return h;
+}
+
+static
+void
+sfs_dirhash_destroy(struct sfs_dirhash *dh)
+{
+	unsigned i;
+
+	for (i=0; i<dh->dh_nslots; i++) {
+		if (dh->dh_slots[i] != NULL) {
+			kfree(dh->dh_slots[i]);
+		}
+	}
+	kfree(dh->dh_slots);
+	kfree(dh->dh_buckets);
+	kfree(dh);
+}
+
+static
+void
+sfs_dirhash_drop(struct sfs_vnode *sv)
+{
+	if (sv->sv_dirhash != NULL) {
+		sfs_dirhash_destroy(sv->sv_dirhash);
+		sv->sv_dirhash = NULL;
+	}
+}
+
+/*
+ * Double the hash chains once they average more than two names. If
+ * there's no memory for that, longer chains will do.
+ */
+static
+void
+sfs_dirhash_rehash(struct sfs_dirhash *dh)
+{
+	struct sfs_dirent **nb, *de;
+	unsigned n, i, b;
+
+	if (dh->dh_count <= 2 * dh->dh_nbuckets) {
+		return;
+	}
+	n = dh->dh_nbuckets * 2;
+	nb = kmalloc(n * sizeof(struct sfs_dirent *));
+	if (nb == NULL) {
+		return;
+	}
+	for (i=0; i<n; i++) {
+		nb[i] = NULL;
+	}
+	for (i=0; i<dh->dh_nslots; i++) {
+		de = dh->dh_slots[i];
+		if (de != NULL) {
+			b = de->de_hash & (n - 1);
+			de->de_next = nb[b];
+			nb[b] = de;
+		}
+	}
+	kfree(dh->dh_buckets);
+	dh->dh_buckets = nb;
+	dh->dh_nbuckets = n;
+}
+
+/*
+ * Enter NAME, in slot SLOT, into the index.
+ */
+static
+int
+sfs_dirhash_insert(struct sfs_dirhash *dh, const char *name, uint32_t ino,
+		   int slot)
+{
+	struct sfs_dirent *de, **ns;
+	unsigned n, i, b;
+	size_t len;
+
+	KASSERT(slot >= 0);
+
+	if ((unsigned)slot >= dh->dh_maxslots) {
+		n = dh->dh_maxslots * 2;
+		if (n <= (unsigned)slot) {
+			n = slot + 1;
+		}
+		ns = kmalloc(n * sizeof(struct sfs_dirent *));
+		if (ns == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<n; i++) {
+			ns[i] = i < dh->dh_nslots ? dh->dh_slots[i] : NULL;
+		}
+		kfree(dh->dh_slots);
+		dh->dh_slots = ns;
+		dh->dh_maxslots = n;
+	}
+	KASSERT(dh->dh_slots[slot] == NULL);
+
+	len = strlen(name);
+	de = kmalloc(sizeof(struct sfs_dirent) + len + 1);
+	if (de == NULL) {
+		return ENOMEM;
+	}
+	de->de_hash = sfs_namehash(name);
+	de->de_ino = ino;
+	de->de_slot = slot;
+	memcpy(de->de_name, name, len + 1);
+
+	b = de->de_hash & (dh->dh_nbuckets - 1);
+	de->de_next = dh->dh_buckets[b];
+	dh->dh_buckets[b] = de;
+	dh->dh_slots[slot] = de;
+	dh->dh_count++;
+	if ((unsigned)slot >= dh->dh_nslots) {
+		dh->dh_nslots = slot + 1;
+	}
+
+	sfs_dirhash_rehash(dh);
+	return 0;
+}
+
+/*
+ * Take whatever is in slot SLOT out of the index.
+ */
+static
+void
+sfs_dirhash_remove(struct sfs_dirhash *dh, int slot)
+{
+	struct sfs_dirent *de, **dp;
+
+	KASSERT(slot >= 0 && (unsigned)slot < dh->dh_nslots);
+
+	de = dh->dh_slots[slot];
+	if (de == NULL) {
+		return;
+	}
+	dp = &dh->dh_buckets[de->de_hash & (dh->dh_nbuckets - 1)];
+	while (*dp != de) {
+		KASSERT(*dp != NULL);
+		dp = &(*dp)->de_next;
+	}
+	*dp = de->de_next;
+	kfree(de);
+
+	dh->dh_slots[slot] = NULL;
+	dh->dh_count--;
+	if ((unsigned)slot < dh->dh_freehint) {
+		dh->dh_freehint = slot;
+	}
+}
+
+static
+struct sfs_dirent *
+sfs_dirhash_find(struct sfs_dirhash *dh, const char *name)
+{
+	struct sfs_dirent *de;
+	uint32_t h;
+
+	h = sfs_namehash(name);
+	for (de = dh->dh_buckets[h & (dh->dh_nbuckets - 1)]; de != NULL;
+	     de = de->de_next) {
+		if (de->de_hash == h && !strcmp(de->de_name, name)) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The lowest free slot, or -1 if the directory is full.
+ */
+static
+int
+sfs_dirhash_freeslot(struct sfs_dirhash *dh)
+{
+	unsigned i;
+
+	for (i = dh->dh_freehint; i < dh->dh_nslots; i++) {
+		if (dh->dh_slots[i] == NULL) {
+			break;
+		}
+	}
+	dh->dh_freehint = i;
+	return i < dh->dh_nslots ? (int)i : -1;
+}
+
+/*
+ * Read the whole directory into a new index, a block of entries at a
+ * time.
+ */
+static
+int
+sfs_dirhash_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_dir *sds;
+	struct iovec iov;
+	struct uio ku;
+	int nentries = sfs_dir_nentries(sv);
+	int i, j, n, result;
+
+	KASSERT(sv->sv_dirhash == NULL);
+
+	sds = kmalloc(SFS_DIRHASH_BATCH * sizeof(struct sfs_dir));
+	dh = kmalloc(sizeof(struct sfs_dirhash));
+	if (sds == NULL || dh == NULL) {
+		goto nomem;
+	}
+	dh->dh_nbuckets = SFS_DIRHASH_MINBUCKETS;
+	dh->dh_buckets = kmalloc(dh->dh_nbuckets * sizeof(struct sfs_dirent *));
+	dh->dh_maxslots = nentries > 0 ? nentries : 1;
+	dh->dh_slots = kmalloc(dh->dh_maxslots * sizeof(struct sfs_dirent *));
+	if (dh->dh_buckets == NULL || dh->dh_slots == NULL) {
+		kfree(dh->dh_buckets);
+		kfree(dh->dh_slots);
+		goto nomem;
+	}
+	for (i=0; i<(int)dh->dh_nbuckets; i++) {
+		dh->dh_buckets[i] = NULL;
+	}
+	for (i=0; i<(int)dh->dh_maxslots; i++) {
+		dh->dh_slots[i] = NULL;
+	}
+	dh->dh_count = 0;
+	dh->dh_nslots = nentries;
+	dh->dh_freehint = 0;
+
+	for (i=0; i<nentries; i+=n) {
+		n = nentries - i;
+		if (n > (int)SFS_DIRHASH_BATCH) {
+			n = SFS_DIRHASH_BATCH;
+		}
+		uio_kinit(&iov, &ku, sds, n * sizeof(struct sfs_dir),
+			  (off_t)i * sizeof(struct sfs_dir), UIO_READ);
+		result = sfs_io(sv, &ku);
+		if (result) {
+			goto fail;
+		}
+		if (ku.uio_resid > 0) {
+			panic("sfs: readdir: Short entry (inode %u)\n",
+			      sv->sv_ino);
+		}
+
+		for (j=0; j<n; j++) {
+			if (sds[j].sfd_ino == SFS_NOINO) {
+				continue;
+			}
+			/* Ensure null termination, just in case */
+			sds[j].sfd_name[sizeof(sds[j].sfd_name)-1] = 0;
+
+			/* Each name may legally appear only once... */
+			KASSERT(sfs_dirhash_find(dh, sds[j].sfd_name) == NULL);
+
+			result = sfs_dirhash_insert(dh, sds[j].sfd_name,
+						    sds[j].sfd_ino, i + j);
+			if (result) {
+				goto fail;
+			}
+		}
+	}
+
+	kfree(sds);
+	sv->sv_dirhash = dh;
+	return 0;
+
+ fail:
+	sfs_dirhash_destroy(dh);
+	kfree(sds);
+	return result;
+
+ nomem:
+	kfree(dh);
+	kfree(sds);
+	return ENOMEM;
+}
+
+/* Below */
+static int sfs_dir_scan(struct sfs_vnode *sv, const char *name,
+			uint32_t *ino, int *slot, int *emptyslot);
+
+/*
+ * Look a name up with the index, building it if need be. If there
+ * isn't memory for it, fall back on sfs_dir_scan.
+ */
+static
+int
+sfs_dir_findname(struct sfs_vnode *sv, const char *name,
+		    uint32_t *ino, int *slot, int *emptyslot)
+{
+	struct sfs_dirhash *dh;
+	struct sfs_dirent *de;
+	int result;
+
+	if (sv->sv_dirhash == NULL) {
+		result = sfs_dirhash_build(sv);
+		if (result == ENOMEM) {
+			return sfs_dir_scan(sv, name, ino, slot, emptyslot);
+		}
+		if (result) {
+			return result;
+		}
+	}
+	dh = sv->sv_dirhash;
+	KASSERT(dh->dh_nslots == (unsigned)sfs_dir_nentries(sv));
+
+	/* Report a free slot back if one was requested */
+	if (emptyslot != NULL) {
+		result = sfs_dirhash_freeslot(dh);
+		if (result >= 0) {
+			*emptyslot = result;
+		}
+	}
+
+	de = sfs_dirhash_find(dh, name);
+	if (de == NULL) {
+		return ENOENT;
+	}
+	if (slot != NULL) {
+		*slot = de->de_slot;
+	}
+	if (ino != NULL) {
+		*ino = de->de_ino;
+	}
+	return 0;
+}
+#endif /* OPT_A3 */
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
@@ -644,8 +1054,13 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 
 static
 int
+#if OPT_A3
+sfs_dir_scan(struct sfs_vnode *sv, const char *name,
+	     uint32_t *ino, int *slot, int *emptyslot)
+#else
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		    uint32_t *ino, int *slot, int *emptyslot)
+#endif /* OPT_A3 */
 {
 	struct sfs_dir tsd;
 	int found = 0;
@@ -729,7 +1144,17 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
+#if OPT_A3
+	result = sfs_writedir(sv, &sd, emptyslot);
+	if (result == 0 && sv->sv_dirhash != NULL &&
+	    sfs_dirhash_insert(sv->sv_dirhash, name, ino, emptyslot)) {
+		/* Out of memory; scan until the index can be rebuilt */
+		sfs_dirhash_drop(sv);
+	}
+	return result;
+#else
 	return sfs_writedir(sv, &sd, emptyslot);
+#endif /* OPT_A3 */
 	
 }
 
@@ -741,13 +1166,24 @@ int
 sfs_dir_unlink(struct sfs_vnode *sv, int slot)
 {
 	struct sfs_dir sd;
+#if OPT_A3
+	int result;
+#endif
 
 	/* Initialize a suitable directory entry... */ 
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
+#if OPT_A3
+	result = sfs_writedir(sv, &sd, slot);
+	if (result == 0 && sv->sv_dirhash != NULL) {
+		sfs_dirhash_remove(sv->sv_dirhash, slot);
+	}
+	return result;
+#else
 	return sfs_writedir(sv, &sd, slot);
+#endif /* OPT_A3 */
 }
 
 /*
@@ -948,6 +1384,9 @@ sfs_reclaim(struct vnode *v)
 	}
 	vnodearray_remove(sfs->sfs_vnodes, ix);
 
+#if OPT_A3
+	sfs_dirhash_drop(sv);
+#endif
 	VOP_CLEANUP(&sv->sv_v);
 
 	vfs_biglock_release();
@@ -1112,6 +1551,20 @@ sfs_fsync(struct vnode *v)
 /*
  * Called for mmap().
  */
+#if OPT_A3
+/*
+ * Any regular file can be mapped: the VM system reads the pages in
+ * and writes them back with sfs_read and sfs_write, through the
+ * buffer cache. (Directories get EISDIR from sfs_dirops.)
+ */
+static
+int
+sfs_mmap(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+#else
 static
 int
 sfs_mmap(struct vnode *v   /* add stuff as needed */)
@@ -1119,6 +1572,7 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 	(void)v;
 	return EUNIMP;
 }
+#endif /* OPT_A3 */
 
 /*
  * Called for ftruncate() and from sfs_reclaim.
@@ -1705,6 +2159,10 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Not dirty yet */
 	sv->sv_dirty = false;
+#if OPT_A3
+	/* Directories get their name index on first lookup */
+	sv->sv_dirhash = NULL;
+#endif
 
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
@@ -37,7 +37,13 @@
 
 #include <vm.h>
 #include "opt-A3.h"
+#include "opt-dumbvm.h"
 struct vnode;
+#if OPT_A3 && !OPT_DUMBVM
+struct array;
+struct pagetable;
+struct cpu;
+#endif /* OPT_A3 && !OPT_DUMBVM */
 
 
 /* 
@@ -47,7 +53,51 @@ struct vnode;
  * You write this.
  */
 
+#if OPT_A3 && !OPT_DUMBVM
+/* one contiguous, page-aligned chunk of the address space */
+struct region {
+  vaddr_t rg_vbase;
+  size_t rg_npages;
+  bool rg_writeable;
+  /* file backing of an ELF segment, read in by vm_fault on first touch */
+  struct vnode *rg_vn;		/* NULL if the region starts out all zero */
+  off_t rg_offset;		/* file offset of the segment's first byte */
+  vaddr_t rg_segbase;		/* (unaligned) address of that byte */
+  size_t rg_filesize;		/* bytes from the file, the rest is zero */
+  /* mmap()ed file; stores to a shared one are written back to rg_vn */
+  bool rg_mapped;
+  bool rg_shared;
+};
+
+/* under our VM, user stacks get this much space, faulted in on demand */
+#define VM_STACKPAGES    256
+
+/*
+ * Software TLB: the last translation vm_fault made for each page,
+ * direct-mapped by page number, so a TLB miss on a resident page can
+ * be refilled without walking the page table. st_elo is 0 if empty.
+ */
+#define AS_STLB_SIZE     64
+#define AS_STLB_INDEX(va) (((va) >> 12) & (AS_STLB_SIZE - 1))
+
+struct stlb_entry {
+  vaddr_t st_vaddr;
+  uint32_t st_elo;
+};
+#endif /* OPT_A3 && !OPT_DUMBVM */
+
 struct addrspace {
+#if OPT_A3 && !OPT_DUMBVM
+  struct array *as_regions;	/* struct region, text/data/stack */
+  struct pagetable *as_pt;	/* resident pages, filled by vm_fault */
+  struct region *as_heap;	/* sbrk's, just above the segments */
+  vaddr_t as_heaptop;		/* the break; the region ends at its page */
+  bool as_loading;		/* all regions writeable while loading */
+  uint32_t as_asid;		/* MIPS ASID our TLB entries are tagged with */
+  uint32_t as_asidgen;		/* as_asid is only good in this generation */
+  struct cpu *as_cpu;		/* the only cpu with entries tagged as_asid */
+  struct stlb_entry as_stlb[AS_STLB_SIZE];
+#else
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
   size_t as_npages1;
@@ -58,6 +108,7 @@ struct addrspace {
 #if OPT_A3
   bool as_got;
 #endif /* OPT_A3 */
+#endif /* OPT_A3 && !OPT_DUMBVM */
 };
 
 /*
@@ -94,6 +145,35 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL if
+ *                the address is not part of the address space.
+ *
+ *    as_define_file - back the region at VADDR with FILESIZE bytes of
+ *                file V from OFFSET on, instead of reading them now.
+ *
+ *    as_fill_page - read the file-backed bytes of the page at VADDR into
+ *                the zeroed kernel page KVA; *FROMFILE says if there
+ *                were any.
+ *
+ *    as_tlbhi  - the TLB entryhi for VADDR in this address space.
+ *
+ *    as_stlb_invalidate - forget the software TLB entry for VADDR.
+ *
+ *    as_map_file - map LEN bytes of file V from OFFSET (page-aligned) on
+ *                into a new region at an unused address, returned in
+ *                *VADDR. Pages are read in by vm_fault.
+ *
+ *    as_sync   - write back to their files the pages stored to in the
+ *                shared mappings between VADDR and VADDR+LEN. Fails
+ *                with ENOMEM if any of that range is not mapped.
+ *
+ *    as_unmap  - write back and remove the mappings between VADDR and
+ *                VADDR+LEN, which must not cut any mapping in two.
+ *
+ *    as_sbrk   - move the top of the heap by AMOUNT bytes, handing back
+ *                the old top in *OLDTOP. Pages it gains are faulted in
+ *                on demand; pages it loses are freed.
  */
 
 struct addrspace *as_create(void);
@@ -110,6 +190,23 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3 && !OPT_DUMBVM
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int               as_define_file(struct addrspace *as, struct vnode *v,
+                                 off_t offset, vaddr_t vaddr,
+                                 size_t filesize);
+int               as_fill_page(struct addrspace *as, vaddr_t vaddr,
+                               vaddr_t kva, bool *fromfile);
+uint32_t          as_tlbhi(struct addrspace *as, vaddr_t vaddr);
+void              as_stlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+int               as_map_file(struct addrspace *as, struct vnode *v,
+                              off_t offset, size_t len, bool writeable,
+                              bool shared, vaddr_t *vaddr);
+int               as_sync(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_unmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldtop);
+#endif /* OPT_A3 && !OPT_DUMBVM */
 
 
 /*
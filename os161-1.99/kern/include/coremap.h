@@ -2,6 +2,7 @@
 #define _COREMAP_H_
 
 #include "opt-A3.h"
+#include "opt-dumbvm.h"
 
 #if OPT_A3
 #include <types.h>
@@ -9,18 +10,63 @@
 #include <vm.h>
 #include <spinlock.h>
 #include <synch.h>
+#include <cpu.h>
+#include <current.h>
+#include <pagetable.h>
+
+struct addrspace;
+
+// largest buddy block is 2^COREMAP_MAXORDER pages, enough for 508M of RAM
+#define COREMAP_MAXORDER	17
+// "no page" for the free list links
+#define COREMAP_NONE		0xffffffff
 
 // pack a physical page's info
 struct coremap_entry {
 	// where is page mapped
 	paddr_t paddr;
 	paddr_t kvaddr;
-	uint32_t sl;		// segment length
+	int order;		// block is 2^order pages if it starts here, else -1
 	bool isDirty;		// pages status
+	uint32_t refcount;	// address spaces sharing this page (copy-on-write)
+	uint32_t next;		// free list links, only valid in a free block's
+	uint32_t prev;		// first entry
+	// paging, for user pages only
+	pte_t *pte;		// the one PTE mapping the page, NULL if shared
+	struct addrspace *as;	// whose PTE that is
+	vaddr_t vaddr;		// user address it is mapped at
+	uint32_t swapslot;	// slot with an identical copy, or SWAP_NOSLOT
+	bool referenced;	// used since the clock hand last came by
+	bool busy;		// being paged out, wait on it
+	// kernel pages only
+	void *kmref;		// kmalloc's pageref, if it split up the page
 };
 
 void coremap_bootstrap(void);
 paddr_t coremap_getppages(unsigned long npages);
 void coremap_free_kpages(vaddr_t addr);
+void coremap_set_pcpu(bool enable);
+uint32_t coremap_npages(void);
+void coremap_kmalloc_set(vaddr_t addr, void *ref);
+bool coremap_kmalloc_get(vaddr_t addr, void **ref);
+
+#if !OPT_DUMBVM
+/*
+ * Paging. Callers may look at and change a user page's entry, and the
+ * PTE that maps it, only between coremap_lock_acquire and
+ * coremap_lock_release, and must coremap_wait (which drops the lock)
+ * and look again if the page is busy.
+ */
+void coremap_pageout_bootstrap(void);
+void coremap_lock_acquire(void);
+void coremap_lock_release(void);
+void coremap_wait(void);
+struct coremap_entry *coremap_entry(paddr_t paddr);
+void coremap_map(pte_t *pte, paddr_t paddr, struct addrspace *as,
+		 vaddr_t vaddr, uint32_t swapslot);
+void coremap_unmap(pte_t *pte);
+int coremap_share(pte_t *opte, pte_t *npte, struct addrspace *as,
+		  vaddr_t vaddr, bool shared);
+#endif
 #endif /* OPT_A3 */
 #endif /* _COREMAP_H_ */
@@ -34,7 +34,14 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-A3.h"
 
+#if OPT_A3
+/* Free pages each cpu may hold back from the coremap (vm/coremap.c). */
+#define CPU_PAGECACHE_MAX 32
+/* Priority levels of each cpu's run queue (thread/thread.c); 0 is highest. */
+#define CPU_NPRIO 4
+#endif /* OPT_A3 */
 
 /*
  * Per-cpu structure
@@ -66,7 +73,13 @@ struct cpu {
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+#if OPT_A3
+	struct threadlist c_runqueue[CPU_NPRIO]; /* Run queues, by priority */
+	unsigned c_runcount;		/* Threads on all of them; read
+					   unlocked as a load estimate */
+#else
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+#endif /* OPT_A3 */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -87,6 +100,37 @@ struct cpu {
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
 	struct spinlock c_ipi_lock;
+
+#if OPT_A3
+	/*
+	 * Free single pages cached by this cpu in front of the
+	 * coremap. Protected by c_pagecache_lock, which other cpus
+	 * only take when rebalancing the coremap.
+	 */
+	paddr_t c_pagecache[CPU_PAGECACHE_MAX];
+	unsigned c_pagecache_num;
+	struct spinlock c_pagecache_lock;
+
+	/*
+	 * TLB state. c_asid is the ASID currently loaded in entryhi;
+	 * the TLB holds nothing older than ASID generation
+	 * c_asidgen. Slots from c_tlb_next up have been free since
+	 * the last flush.
+	 */
+	uint32_t c_asid;
+	uint32_t c_asidgen;
+	unsigned c_tlb_next;
+
+	/*
+	 * Epoch read sections (thread/synch.c). c_epoch is the epoch
+	 * this cpu's outermost section started in, or 0 outside any
+	 * section; epoch_synchronize reads it without a lock. The
+	 * rest is only touched by this cpu.
+	 */
+	volatile unsigned c_epoch;
+	unsigned c_epoch_nest;
+	int c_epoch_spl;
+#endif /* OPT_A3 */
 };
 
 #define TLBSHOOTDOWN_ALL  (-1)
@@ -99,12 +143,19 @@ struct cpu {
  *
  * cpu_create calls cpu_machdep_init.
  *
+ * cpu_count and cpu_get let code outside the thread system walk the
+ * cpus, e.g. to reach their per-cpu caches.
+ *
  * cpu_start_secondary is the platform-dependent assembly language
  * entry point for new CPUs; it can be found in start.S. It calls
  * cpu_hatch after having claimed the startup stack and thread created
  * for the cpu.
  */
 struct cpu *cpu_create(unsigned hardware_number);
+#if OPT_A3
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+#endif /* OPT_A3 */
 void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
@@ -0,0 +1,54 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+#include "opt-A2.h"
+
+#if OPT_A2
+#include <types.h>
+#include <limits.h>
+#include <spinlock.h>
+
+struct vnode;
+struct lock;
+struct proc;
+
+/*
+ * An open file: what open() hands back, shared by every descriptor
+ * that refers to it, in this process and in its forked children. The
+ * offset moves under of_lock, which also keeps reads and writes
+ * through the same open file from interleaving.
+ */
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			// open flags (O_ACCMODE, O_APPEND)
+	off_t of_offset;
+	struct lock *of_lock;
+	unsigned of_refcount;		// descriptors pointing here
+	struct spinlock of_reflock;
+};
+
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+/*
+ * A process's descriptor table. Only the process's own threads change
+ * it; they do so under fd_lock.
+ */
+struct fdtable {
+	struct openfile *fd_files[OPEN_MAX];
+	struct spinlock fd_lock;
+};
+
+struct fdtable *fdtable_create(void);
+int fdtable_stdio(struct fdtable *fdt);
+void fdtable_copy(struct fdtable *old, struct fdtable *new);
+void fdtable_destroy(struct fdtable *fdt);
+
+int fd_alloc(struct fdtable *fdt, struct openfile *of, int *ret);
+struct openfile *fd_replace(struct fdtable *fdt, int fd, struct openfile *of);
+struct openfile *fd_get(struct proc *p, int fd, bool *held);
+void fd_put(struct openfile *of, bool held);
+
+#endif /* OPT_A2 */
+#endif /* _FILE_H_ */
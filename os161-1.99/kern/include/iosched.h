@@ -0,0 +1,64 @@
+#ifndef _IOSCHED_H_
+#define _IOSCHED_H_
+
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <types.h>
+
+struct device;
+struct uio;
+
+/*
+ * I/O scheduler between the file system and block devices.
+ *
+ * Every attached device has a queue of pending requests, kept sorted
+ * by block, and a worker thread that issues them to the device one at
+ * a time, in the order the current policy picks:
+ *
+ *   IOSCHED_FIFO      arrival order
+ *   IOSCHED_CSCAN     ascending block from where the disk head is,
+ *                     then back to the lowest block
+ *   IOSCHED_DEADLINE  C-SCAN, but a request that has been passed over
+ *                     too often goes first (reads sooner than writes)
+ *
+ * A request is queued with iosched_submit and waited for with
+ * iosched_wait, so a caller that has many blocks to move (sfs_bsync)
+ * submits them all before waiting. One-at-a-time synchronous I/O
+ * gains nothing from a queue and goes to the device directly.
+ *
+ * Requests carry a kernel-space uio covering whole blocks. Callers
+ * must not have two requests for the same block outstanding at once.
+ * Devices are attached once, before their first request, and detached
+ * once they are done with; callers serialize that (sfs does it at
+ * mount and unmount, under vfs_biglock).
+ */
+#define IOSCHED_FIFO		0
+#define IOSCHED_CSCAN		1
+#define IOSCHED_DEADLINE	2
+#define IOSCHED_NPOLICIES	3
+
+// dispatches a waiting read or write may be passed over under deadline
+#define IOSCHED_READ_EXPIRE	8
+#define IOSCHED_WRITE_EXPIRE	32
+
+struct ioreq {
+	struct uio *ior_uio;
+	uint32_t ior_block;		// first block
+	uint32_t ior_arrival;		// place in arrival order
+	uint32_t ior_queued;		// dispatches done when it was queued
+	bool ior_done;
+	int ior_result;
+	struct ioreq *ior_next;		// next higher block in the queue
+};
+
+int iosched_attach(struct device *dev);
+void iosched_detach(struct device *dev);
+void iosched_submit(struct device *dev, struct ioreq *r, struct uio *uio);
+int iosched_wait(struct device *dev, struct ioreq *r);
+
+int iosched_setpolicy(const char *name);
+const char *iosched_getpolicy(void);
+
+#endif /* OPT_A3 */
+#endif /* _IOSCHED_H_ */
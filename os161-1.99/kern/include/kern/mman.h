@@ -0,0 +1,34 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Flags for mmap(), munmap() and msync(), shared between the kernel
+ * and libc.
+ */
+
+/* page protections; the MIPS can't keep readable pages from running */
+#define PROT_NONE     0x0
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+
+/*
+ * mmap flags: exactly one of these.
+ *
+ * A MAP_SHARED mapping's stores go back to the file at msync, munmap
+ * and exit. It is shared with the processes forked from the one that
+ * made it: they all use the same pages, and see each other's stores
+ * at once. (To that end fork reads the whole mapping in, and it stays
+ * in memory while it is shared.) Separate mmap calls on one file, in one process or in
+ * several, get pages of their own instead. Each sees the others'
+ * stores only after they have been written back, and only in pages
+ * it has not yet touched.
+ */
+#define MAP_SHARED    0x1    /* stores go back to the file */
+#define MAP_PRIVATE   0x2    /* stores stay in this process */
+
+/* msync flags; both write the pages back before returning */
+#define MS_ASYNC      0x1
+#define MS_SYNC       0x2
+
+#endif /* _KERN_MMAN_H_ */
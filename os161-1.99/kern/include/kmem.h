@@ -0,0 +1,62 @@
+#ifndef _KMEM_H_
+#define _KMEM_H_
+
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <types.h>
+#include <spinlock.h>
+
+/*
+ * Object caches: a slab allocator for kernel objects of one type.
+ *
+ * Objects come from page-sized slabs, each with a small header at the
+ * start of the page, so freeing one finds its slab by masking the
+ * address. In front of the slabs every cpu has a magazine of up to
+ * KMEM_MAGSIZE free objects, under a lock of its own, so allocating
+ * and freeing on different cpus doesn't contend; a magazine that runs
+ * empty or full trades half of KMEM_MAGSIZE objects with the slabs at
+ * once.
+ *
+ * A cache can be created with kmem_cache_create, or defined statically
+ * with KMEM_CACHE_INITIALIZER, which needs no setup and so works from
+ * the first thing the kernel does. Objects are not initialized, and
+ * must be freed to the cache they came from. kmem_cache_alloc may
+ * sleep; kmem_cache_free may not, and can be called with spinlocks
+ * held.
+ */
+
+#define KMEM_MAXCPUS	32		// as many as a LAMEbus can hold
+#define KMEM_MAGSIZE	16
+
+// object sizes are kept 8-byte aligned
+#define KMEM_ROUNDUP(sz)	(((sz) + 7) & ~(size_t)7)
+
+struct kmem_slab;
+
+struct kmem_magazine {
+	struct spinlock m_lock;
+	unsigned m_count;
+	void *m_objs[KMEM_MAGSIZE];
+};
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			// rounded object size
+	struct spinlock kc_lock;	// for the fields below
+	struct kmem_slab *kc_partial;	// slabs with free objects
+	unsigned kc_nslabs;		// slabs allocated
+	unsigned kc_nempty;		// ...of which completely free
+	struct kmem_magazine *kc_mags[KMEM_MAXCPUS];	// by cpu number
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size) \
+	{ name, KMEM_ROUNDUP(size), SPINLOCK_INITIALIZER, NULL, 0, 0, { NULL } }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size);
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+#endif /* OPT_A3 */
+#endif /* _KMEM_H_ */
@@ -0,0 +1,52 @@
+#ifndef _NAMECACHE_H_
+#define _NAMECACHE_H_
+
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <types.h>
+
+struct vnode;
+struct fs;
+
+/*
+ * Name cache in front of VOP_LOOKUP.
+ *
+ * vfs_lookup hands a filesystem a starting directory and the rest of
+ * the path, which it resolves itself (sfs takes one name, emufs a
+ * whole relative path). The cache maps that pair to the vnode that
+ * came back, or, for ENOENT, to a negative entry, so that the next
+ * lookup of the same thing doesn't go to the filesystem at all. At
+ * most NC_MAXENTRIES are kept; the least recently used go first.
+ *
+ * An entry holds a reference to its directory, and to its vnode if it
+ * has one, so neither can be reclaimed, and its memory reused, while
+ * it is cached.
+ *
+ * When a name in a directory is created, removed or renamed,
+ * namecache_invalidate drops the entry for exactly that (directory,
+ * name). That is all a filesystem like sfs, which looks up one name
+ * at a time, ever needs. A cached path of several names, as emufs
+ * resolves, might run through the changed name from anywhere, so
+ * those are dropped filesystem-wide: just the negative ones for a
+ * creation. namecache_purge drops a whole filesystem's entries, at
+ * unmount.
+ *
+ * Everything here is protected by vfs_biglock, which these functions
+ * take (recursively) themselves. Callers changing a directory hold it
+ * across the change and the invalidation, so that no lookup can put
+ * the old answer back in between.
+ */
+#define NC_MAXENTRIES	256
+#define NC_NBUCKETS	64		// a power of 2
+
+bool namecache_lookup(struct vnode *dir, const char *name,
+		      struct vnode **ret);
+void namecache_enter(struct vnode *dir, const char *name, struct vnode *vn);
+void namecache_invalidate(struct vnode *dir, const char *name,
+			  bool negative_only);
+void namecache_purge(struct fs *fs, bool negative_only);
+void namecache_printstats(void);
+
+#endif /* OPT_A3 */
+#endif /* _NAMECACHE_H_ */
@@ -0,0 +1,53 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <types.h>
+#include <vm.h>
+
+struct addrspace;
+
+/*
+ * Two-level page table for one address space.
+ *
+ * A user virtual address is split 10/10/12: the top 10 bits index
+ * pt_dir, the next 10 bits index a second-level table of PT_L2_SIZE
+ * entries, and the low 12 bits are the page offset. Only the lower
+ * half of the directory is ever used, since user space stops at
+ * USERSPACETOP. Second-level tables are allocated on first use.
+ */
+
+// a page table entry: physical frame in the top 20 bits, flags below.
+// A page that was evicted keeps its swap slot in the top 20 bits instead.
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	// physical frame of a resident page
+#define PTE_VALID	0x00000001	// page is resident in PTE_FRAME
+#define PTE_SWAPPED	0x00000002	// page is out in swap slot PTE_SLOT
+#define PTE_DIRTY	0x00000004	// shared file page not yet written back
+
+#define PTE_SLOT(pte)		((pte) >> PT_L2_SHIFT)
+#define PTE_MKSWAP(slot)	(((slot) << PT_L2_SHIFT) | PTE_SWAPPED)
+
+#define PT_L1_SHIFT	22
+#define PT_L2_SHIFT	12
+#define PT_L2_SIZE	1024
+#define PT_L1_SIZE	(USERSPACETOP >> PT_L1_SHIFT)
+
+#define PT_L1_INDEX(va)	((va) >> PT_L1_SHIFT)
+#define PT_L2_INDEX(va)	(((va) >> PT_L2_SHIFT) & (PT_L2_SIZE - 1))
+
+struct pagetable {
+	pte_t *pt_dir[PT_L1_SIZE];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t va, bool create);
+int pt_copy(struct pagetable *old, struct pagetable *new,
+	    struct addrspace *newas);
+
+#endif /* OPT_A3 */
+#endif /* _PAGETABLE_H_ */
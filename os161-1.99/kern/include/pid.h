@@ -14,27 +14,36 @@
 #include <addrspace.h>
 #include <syscall.h>
 
-/*struct semaphore *pid_sem;
-struct lock *pid_lock;
-struct cv *pid_cv;
-struct array *proc_array;	// array of proc
-struct array *pid_array;	// array of pid
-pid_t nextpid;			//  next new pid
-*/
+/*
+ * PID table. Slot pid % PID_SLOTS holds everything about pid: a slot
+ * hands out pid, pid + PID_SLOTS, pid + 2*PID_SLOTS, ... (wrapping
+ * below PID_MAX), so a stale pid never matches the slot's next user.
+ * Free slots are chained through the table itself. Each process
+ * keeps a list of its children and a cv of its own to wait for them
+ * on, so an exit only wakes up its parent.
+ */
+#define PID_SLOTS	512
+
 struct
 pidinfo
 {
-	pid_t pid;	// children pid
+	pid_t pid;	// pid in use, or the next one to hand out if free
 	pid_t ppid;	// parent pid
 	int exitcode;
+	bool inuse;
 	bool cexited;	// if children exited
-	bool pexited;	// if parent exited
-	//struct cv *pid_cv;
+	bool pexited;	// if parent exited, or there never was one
+	struct pidinfo *nextfree;
+	// our children, linked through their sibling pointers
+	struct pidinfo *children;
+	struct pidinfo *sibling;
+	struct pidinfo **psibling;	// link pointing at us
+	struct cv *waitcv;		// we wait here for our children
 };
 
-struct pidinfo *pidinfo_create(pid_t pid, pid_t ppid);
 void pid_bootstrap(void);
 void pid_check_pid(struct proc *proc);
+void pid_release(struct proc *proc);
 bool pid_wait(struct proc *proc, pid_t pid, int *exitstatus, int *result);
 void pid_exit(struct proc *proc, int exitcode);
 int pid_fork(struct trapframe *tf, pid_t *retval, struct proc *proc);
@@ -43,6 +43,9 @@
 
 struct addrspace;
 struct vnode;
+#if OPT_A2
+struct fdtable;
+#endif /* OPT_A2 */
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -74,6 +77,7 @@ struct proc {
 
 #if OPT_A2
 	pid_t pid;			/* pid in this process */
+	struct fdtable *p_fdtable;	/* open file descriptors */
 #endif /* OPT_A2 */
 
 };
@@ -30,6 +30,7 @@
 #ifndef _SFS_H_
 #define _SFS_H_
 
+#include "opt-A3.h"
 
 /*
  * Header for SFS, the Simple File System.
@@ -48,11 +49,18 @@
  */
 #include <kern/sfs.h>
 
+#if OPT_A3
+struct sfs_dirhash;
+#endif
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+#if OPT_A3
+	struct sfs_dirhash *sv_dirhash;	/* directory name index, or NULL */
+#endif
 };
 
 struct sfs_fs {
@@ -84,6 +92,21 @@ int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, uint32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, uint32_t block);
 
+#if OPT_A3
+/*
+ * Buffer cache (see sfs_io.c). sfs_bread pins a block's buffer until
+ * sfs_brelse; sfs_bdirty marks it to be written back by sfs_bsync.
+ */
+struct sfs_buf;
+int sfs_bread(struct sfs_fs *sfs, uint32_t block, bool fill,
+	      struct sfs_buf **ret);
+void *sfs_bdata(struct sfs_buf *b);
+void sfs_bdirty(struct sfs_buf *b);
+void sfs_brelse(struct sfs_buf *b);
+int sfs_bsync(struct sfs_fs *sfs);
+void sfs_binval(struct sfs_fs *sfs);
+#endif
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-A3.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,6 +55,40 @@
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
+#if OPT_A3
+/*
+ * Spinlocks are ticket locks: an acquirer takes the next number from
+ * lk_next and spins until lk_serving reaches it, so CPUs get the lock
+ * in the order they asked for it and none can be starved, and while
+ * waiting they only read.
+ *
+ * Each lock also counts its acquisitions, how many of them had to
+ * wait, and the total number of times round the wait loop. Locks that
+ * have had to wait are put on a list for spinlock_printstats (the
+ * "lks" menu command), which means a spinlock must be cleaned up
+ * before the memory it is in is freed.
+ */
+struct spinlock {
+	volatile spinlock_data_t lk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t lk_serving; /* Ticket that holds the lock. */
+	struct cpu *lk_holder;		/* CPU holding this lock. */
+
+	/* Statistics, updated by the holder. */
+	unsigned lk_acquires;		/* Times acquired. */
+	unsigned lk_contended;		/* ...after waiting. */
+	uint64_t lk_spins;		/* Wait loop iterations, in all. */
+	vaddr_t lk_firstpc;		/* Caller that first had to wait. */
+	struct spinlock *lk_hotnext;	/* Link on the contended list. */
+	struct spinlock **lk_hotprevp;	/* NULL if not on it. */
+};
+
+/*
+ * Initializer for cases where a spinlock needs to be static or global.
+ */
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL, \
+	  0, 0, 0, 0, NULL, NULL }
+#else
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
@@ -63,6 +98,7 @@ struct spinlock {
  * Initializer for cases where a spinlock needs to be static or global.
  */
 #define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#endif /* OPT_A3 */
 
 /*
  * Spinlock functions.
@@ -74,6 +110,8 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * printstats	Print the most contended spinlocks (OPT_A3).
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -84,5 +122,9 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+#if OPT_A3
+void spinlock_printstats(void);
+#endif /* OPT_A3 */
+
 
 #endif /* _SPINLOCK_H_ */
@@ -0,0 +1,31 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <types.h>
+
+/*
+ * Swap space on the raw disk lhd0raw:, carved into page-sized slots.
+ * Which slots are in use is kept in a bitmap. Without the disk the
+ * kernel runs as before, it just cannot evict anything.
+ */
+
+#define SWAP_DEVICE	"lhd0raw:"
+// "no slot"
+#define SWAP_NOSLOT	0xffffffff
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+
+// slot bookkeeping; swap_free may be called with spinlocks held
+int swap_alloc(uint32_t *slot);
+void swap_free(uint32_t slot);
+
+// move one page between physical memory and a slot; these sleep
+int swap_in(uint32_t slot, paddr_t paddr);
+int swap_out(uint32_t slot, paddr_t paddr);
+
+#endif /* OPT_A3 */
+#endif /* _SWAP_H_ */
@@ -36,6 +36,7 @@
 
 
 #include <spinlock.h>
+#include "opt-A3.h"
 
 /*
  * Dijkstra-style semaphore.
@@ -71,6 +72,12 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held spins while
+ * the holder is running on another cpu, since it is likely to let go
+ * sooner than a context switch would take, and sleeps otherwise. The
+ * counters say how often that happened; look at them from the
+ * debugger.
  */
 struct lock {
         char *lk_name;
@@ -83,6 +90,14 @@ struct lock {
 	 * which makes the pointer to thread structure a good enough thread id
 	 */
 	volatile struct thread *lk_holder;
+
+#if OPT_A3
+	/* contention statistics, under lk_lock */
+	unsigned lk_acquires;		/* lock_acquire calls */
+	unsigned lk_contended;		/* ...that found the lock held */
+	unsigned lk_spins;		/* times a waiter spun on a running holder */
+	unsigned lk_sleeps;		/* times a waiter went to sleep */
+#endif /* OPT_A3 */
 	
 	// for make sure a thread won't accidentally loose a lock
 	//volatile int lk_count; 
@@ -151,4 +166,57 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+#if OPT_A3
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold it at once, or one writer. Writers
+ * are preferred: once a writer is waiting, new readers wait behind it,
+ * so a steady stream of readers can't starve it. Neither side may be
+ * taken recursively, and a reader may not upgrade to a writer.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock {
+	char *rwlock_name;
+	struct spinlock rwlock_lock;	/* for the fields below */
+	struct wchan *rwlock_rwchan;	/* readers wait here */
+	struct wchan *rwlock_wwchan;	/* writers wait here */
+	unsigned rwlock_readers;	/* readers holding it */
+	unsigned rwlock_wwaiting;	/* writers waiting for it */
+	volatile struct thread *rwlock_writer;	/* writer holding it */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+/*
+ * Epochs: read-side critical sections that take no locks at all.
+ *
+ * A reader brackets its lookup with epoch_enter and epoch_exit; in
+ * between it may follow pointers into a shared structure, but may not
+ * sleep (interrupts are off, as under a spinlock), and it must not
+ * keep anything it found past epoch_exit without some other reference.
+ * Sections nest.
+ *
+ * An updater unlinks or retires an object first, under whatever lock
+ * the updaters share, then calls epoch_synchronize, which returns once
+ * every reader that might have seen the old object has left its
+ * section; then the object can be reused or freed. epoch_synchronize
+ * waits, so it can't be called with spinlocks held or from inside a
+ * section; batch retirements so it is called rarely.
+ */
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_synchronize(void);
+#endif /* OPT_A3 */
+
+
 #endif /* _SYNCH_H_ */
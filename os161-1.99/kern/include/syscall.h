@@ -31,6 +31,7 @@
 #define _SYSCALL_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 struct trapframe; /* from <machine/trapframe.h> */
 
 /*
@@ -50,6 +51,12 @@ void enter_forked_process(void *data1, unsigned long data2);
 void enter_forked_process(struct trapframe *tf);
 #endif /* OPT_A2 */
 
+#if OPT_A3
+/* Object cache for the trapframe fork hands to enter_forked_process. */
+struct kmem_cache;
+extern struct kmem_cache trapframe_cache;
+#endif /* OPT_A3 */
+
 /* Enter user mode. Does not return. */
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
@@ -72,8 +79,29 @@ int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
 int sys_fork(struct trapframe *tf, pid_t *retval);
 
 int sys_execv(char *progname, char **uargs);
+
+int sys_open(userptr_t upath, int flags, mode_t mode, int *retval);
+int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_close(int fdesc);
+int sys_lseek(int fdesc, off_t pos, int whence, off_t *retval);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_pread(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval);
+int sys_pwrite(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos,
+	       int *retval);
+int sys_readv(int fdesc, userptr_t uiov, int iovcnt, int *retval);
+int sys_writev(int fdesc, userptr_t uiov, int iovcnt, int *retval);
+int sys_sendfile(int outfd, int infd, userptr_t uoffset, size_t len,
+                 int *retval);
 #endif /* OPT_A2*/
 
+#if OPT_A3
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fdesc,
+             off_t offset, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+#endif /* OPT_A3 */
+
 #endif // UW
 
 #endif /* _SYSCALL_H_ */
@@ -31,6 +31,7 @@
 #define _TEST_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * Declarations for test code and other miscellaneous high-level
@@ -62,6 +63,10 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+#if OPT_A3
+int rwtest(int, char **);
+int epochtest(int, char **);
+#endif /* OPT_A3 */
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -81,6 +86,9 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+#if OPT_A3
+int pagebench(int, char **);
+#endif /* OPT_A3 */
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include "opt-A3.h"
 
 struct cpu;
 
@@ -82,6 +83,11 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+#if OPT_A3
+	unsigned t_priority;		/* Run queue level, 0 is highest */
+	unsigned t_quantum;		/* Hardclocks left in this quantum */
+	unsigned t_lastran;		/* t_cpu's hardclocks when it last ran */
+#endif /* OPT_A3 */
 
 	/*
 	 * Interrupt state fields.
@@ -161,11 +167,20 @@ void thread_yield(void);
  */
 void schedule(void);
 
+#if OPT_A3
+/*
+ * Charge the current thread for one hardclock, and switch away from
+ * it if its quantum is used up or a higher-priority thread is ready.
+ * Called from the timer interrupt.
+ */
+void thread_tick(void);
+#else
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
+#endif /* OPT_A3 */
 
 
 #endif /* _THREAD_H_ */
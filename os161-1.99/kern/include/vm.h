@@ -37,6 +37,7 @@
  */
 
 
+#include "opt-A3.h"
 #include <machine/vm.h>
 
 /* Fault-type arguments to vm_fault() */
@@ -59,5 +60,14 @@ void free_kpages(vaddr_t addr);
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+#if OPT_A3
+/* Remove one entry (by entryhi) from every cpu's TLB, and wait */
+void vm_tlbshootdown_page(uint32_t entryhi);
+
+/* Make the page at VA of AS resident, as a fault on it would */
+struct addrspace;
+int vm_populate(struct addrspace *as, vaddr_t va);
+#endif
+
 
 #endif /* _VM_H_ */
@@ -138,6 +138,8 @@ struct vnode {
  *    vop_mmap        - Map file into memory. If you implement this
  *                      feature, you're responsible for choosing the
  *                      arguments for this operation.
+ *                      (A3: returns 0 if the file may be mapped; the
+ *                      VM system pages it with vop_read and vop_write.)
  *
  *    vop_truncate    - Forcibly set size of file to the length passed
  *                      in, discarding any excess blocks.
@@ -1,183 +1,356 @@
 
 #include <pid.h>
+#include <file.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <kmem.h>
+#endif /* OPT_A3 */
 
 //#include <synch.h>
 
-struct semaphore *pid_sem;
 struct lock *pid_lock;
-struct cv *pid_cv;
-struct array *proc_array;	// array of proc
-struct array *pid_array;	// array of pid
-pid_t nextpid;			//  next new pid
-
-struct
-pidinfo *pidinfo_create(pid_t pid, pid_t ppid)
+static struct pidinfo pid_table[PID_SLOTS];
+// free slots; taking and returning one only needs this spinlock
+static struct pidinfo *pid_freelist;
+static struct spinlock pid_freelock = SPINLOCK_INITIALIZER;
+#if OPT_A3
+// freed slots still showing their old pid; see pidinfo_free
+static struct pidinfo *pid_limbo;
+#endif /* OPT_A3 */
+
+// slot in use by pid, or NULL
+static
+struct pidinfo *
+pidinfo_get(pid_t pid)
 {
 	struct pidinfo *pidinfo;
-	pidinfo = kmalloc(sizeof(*pidinfo));
-	pidinfo->pid = pid;
-	pidinfo->ppid = ppid;
-	pidinfo->exitcode = 0;
-	pidinfo->cexited = false;
-	pidinfo->pexited = false;
 
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return NULL;
+	}
+	pidinfo = &pid_table[pid % PID_SLOTS];
+	if (!pidinfo->inuse || pidinfo->pid != pid) {
+		return NULL;
+	}
 	return pidinfo;
 }
 
+// take a child off its parent's list; pid_lock held
+static
 void
-pid_bootstrap(void)
+pidinfo_unlink(struct pidinfo *pidinfo)
 {
-	pid_sem = sem_create("pid_sem", 1);
-	if (pid_sem == NULL) {
-		panic("could not create pid_sem semaphore\n");
+	KASSERT(pidinfo->psibling != NULL);
+	*pidinfo->psibling = pidinfo->sibling;
+	if (pidinfo->sibling != NULL) {
+		pidinfo->sibling->psibling = pidinfo->psibling;
 	}
+	pidinfo->sibling = NULL;
+	pidinfo->psibling = NULL;
+}
 
+#if OPT_A3
+// the pid a slot hands out after pid
+static
+pid_t
+pidinfo_nextpid(pid_t pid)
+{
+	pid += PID_SLOTS;
+	if (pid > PID_MAX) {
+		// start the slot's pids over
+		pid = pid % PID_SLOTS;
+		if (pid < PID_MIN) {
+			pid += PID_SLOTS;
+		}
+	}
+	return pid;
+}
+
+/*
+ * Retire the slot. pid_wait looks pids up inside an epoch section
+ * rather than under pid_lock, so the slot can't take its next pid
+ * while such a lookup may still be reading it: it waits in limbo, with
+ * its old pid, until pid_reclaim.
+ */
+static
+void
+pidinfo_free(struct pidinfo *pidinfo)
+{
+	KASSERT(pidinfo->children == NULL && pidinfo->psibling == NULL);
+
+	spinlock_acquire(&pid_freelock);
+	pidinfo->inuse = false;
+	pidinfo->nextfree = pid_limbo;
+	pid_limbo = pidinfo;
+	spinlock_release(&pid_freelock);
+}
+
+/*
+ * Move everything in limbo to the free list with its next pid, after
+ * a grace period, which is paid once for the whole batch. Nothing else
+ * touches the slots while they are off both lists.
+ */
+static
+void
+pid_reclaim(void)
+{
+	struct pidinfo *limbo, *last;
+
+	spinlock_acquire(&pid_freelock);
+	limbo = pid_limbo;
+	pid_limbo = NULL;
+	spinlock_release(&pid_freelock);
+	if (limbo == NULL) {
+		return;
+	}
+
+	epoch_synchronize();
+
+	for (last = limbo; ; last = last->nextfree) {
+		last->pid = pidinfo_nextpid(last->pid);
+		if (last->nextfree == NULL) {
+			break;
+		}
+	}
+
+	spinlock_acquire(&pid_freelock);
+	last->nextfree = pid_freelist;
+	pid_freelist = limbo;
+	spinlock_release(&pid_freelock);
+}
+#else
+// put the slot back on the free list, with its next pid ready
+static
+void
+pidinfo_free(struct pidinfo *pidinfo)
+{
+	pid_t pid = pidinfo->pid + PID_SLOTS;
+
+	KASSERT(pidinfo->children == NULL && pidinfo->psibling == NULL);
+
+	if (pid > PID_MAX) {
+		// start the slot's pids over
+		pid = pid % PID_SLOTS;
+		if (pid < PID_MIN) {
+			pid += PID_SLOTS;
+		}
+	}
+
+	spinlock_acquire(&pid_freelock);
+	pidinfo->inuse = false;
+	pidinfo->pid = pid;
+	pidinfo->nextfree = pid_freelist;
+	pid_freelist = pidinfo;
+	spinlock_release(&pid_freelock);
+}
+#endif /* OPT_A3 */
+
+void
+pid_bootstrap(void)
+{
 	pid_lock = lock_create("pid_lock");
 	if (pid_lock == NULL) {
 		panic("could not create pid_lock lock\n");
 	}
 
-	pid_cv = cv_create("pid_cv");
-	if (pid_cv == NULL) {
-		panic("could not create pid_cv condition variable");
+	// hand out PID_MIN, PID_MIN+1, ... first; slots below PID_MIN go last
+	pid_freelist = NULL;
+#if OPT_A3
+	pid_limbo = NULL;
+#endif /* OPT_A3 */
+	for (int i = PID_SLOTS - 1; i >= 0; i--) {
+		int slot = (i + PID_MIN) % PID_SLOTS;
+		struct pidinfo *pidinfo = &pid_table[slot];
+
+		pidinfo->pid = slot < PID_MIN ? slot + PID_SLOTS : slot;
+		pidinfo->ppid = 0;
+		pidinfo->exitcode = 0;
+		pidinfo->inuse = false;
+		pidinfo->cexited = false;
+		pidinfo->pexited = false;
+		pidinfo->children = NULL;
+		pidinfo->sibling = NULL;
+		pidinfo->psibling = NULL;
+		pidinfo->waitcv = cv_create("pid_wait");
+		if (pidinfo->waitcv == NULL) {
+			panic("could not create pid_wait condition variable");
+		}
+		pidinfo->nextfree = pid_freelist;
+		pid_freelist = pidinfo;
 	}
-
-	proc_array = array_create();
-	pid_array = array_create();
-
-	// leave pid = 0 alone, for MACROS, WAIT_MYPGRP(0)
-	nextpid = 1;
 }
 
+/*
+ * Give the new process a pid, or 0 if they have all run out. Nobody
+ * waits for it unless pid_fork makes it somebody's child.
+ */
 void
 pid_check_pid(struct proc *proc)
 {
-	P(pid_sem);
-
-	if (array_num(pid_array) == 0) {
-		// allocate a new pid and set it for this process
-		nextpid++;
-		proc->pid = nextpid;
-
-	}else{
-		// exist pid, reuse it, then remove it from the array
-		proc->pid = *((pid_t *) array_get(pid_array, 0));
-		kfree(array_get(pid_array, 0));
-		array_remove(pid_array, 0);
+	struct pidinfo *pidinfo;
+
+#if OPT_A3
+	for (;;) {
+		spinlock_acquire(&pid_freelock);
+		pidinfo = pid_freelist;
+		if (pidinfo != NULL || pid_limbo == NULL) {
+			break;
+		}
+		spinlock_release(&pid_freelock);
+		pid_reclaim();
+	}
+#else
+	spinlock_acquire(&pid_freelock);
+	pidinfo = pid_freelist;
+#endif /* OPT_A3 */
+	if (pidinfo == NULL) {
+		spinlock_release(&pid_freelock);
+		proc->pid = 0;
+		return;
 	}
+	pid_freelist = pidinfo->nextfree;
 
-	V(pid_sem);
+	pidinfo->ppid = 0;
+	pidinfo->exitcode = 0;
+	pidinfo->cexited = false;
+	pidinfo->pexited = true;
+	pidinfo->inuse = true;
+	proc->pid = pidinfo->pid;
+	spinlock_release(&pid_freelock);
+}
+
+/*
+ * Give back the pid of a process that never got to run.
+ */
+void
+pid_release(struct proc *proc)
+{
+	lock_acquire(pid_lock);
+	struct pidinfo *pidinfo = pidinfo_get(proc->pid);
+	if (pidinfo != NULL) {
+		if (pidinfo->psibling != NULL) {
+			pidinfo_unlink(pidinfo);
+		}
+		pidinfo_free(pidinfo);
+	}
+	lock_release(pid_lock);
 }
 
+#if OPT_A3
+/*
+ * Only the parent can reap a child, so once a lookup has found that
+ * pid is our child it stays that way until we reap it, and we only
+ * need pid_lock to wait for it. The lookup itself, and the errors,
+ * need no lock: inside an epoch section the slot can't be given a new
+ * pid under us (see pidinfo_free).
+ */
 bool
 pid_wait(struct proc *proc, pid_t pid, int *exitstatus, int *result)
 {
-	bool b;
+	struct pidinfo *pidinfo;
+
+	epoch_enter();
+	pidinfo = pidinfo_get(pid);
+	if (pidinfo == NULL) {
+		*result = ESRCH;
+	} else if (pidinfo->pexited || proc->pid != pidinfo->ppid) {
+		*result = ECHILD;
+	} else {
+		*result = 0;
+	}
+	epoch_exit();
+	if (*result) {
+		return true;
+	}
+
 	lock_acquire(pid_lock);
+	KASSERT(pidinfo->inuse && pidinfo->pid == pid);
 
-	unsigned np = array_num(proc_array);
-	b = false;
-	
-	for (unsigned i = 0; i < np; i++) {
-		struct pidinfo *pidinfo = (struct pidinfo *) array_get(proc_array, i);
-		
-		// check does the waited pid exist
-		if (pidinfo->pid == pid) {
-			// if valid, check if we are allowed to wait it
-			if (proc->pid == pidinfo->ppid) {
-				// wait for children processing
-				while (!pidinfo->cexited) {
-					cv_wait(pid_cv, pid_lock);
-				}
-
-				KASSERT(pidinfo->cexited);
-				*exitstatus = pidinfo->exitcode;
-				b = true;
-				break;
-			} else {
-				lock_release(pid_lock);
-				*result = ECHILD;
-				return true;
-			}
-		}
+	while (!pidinfo->cexited) {
+		cv_wait(pid_table[proc->pid % PID_SLOTS].waitcv, pid_lock);
 	}
-	
+	*exitstatus = pidinfo->exitcode;
+
+	// reaped, the pid can go to somebody else
+	pidinfo_unlink(pidinfo);
+	pidinfo_free(pidinfo);
+
 	lock_release(pid_lock);
-	
-	// fail to search
-	if (!b) {
+	return false;
+}
+#else
+bool
+pid_wait(struct proc *proc, pid_t pid, int *exitstatus, int *result)
+{
+	lock_acquire(pid_lock);
+
+	struct pidinfo *pidinfo = pidinfo_get(pid);
+	// check does the waited pid exist
+	if (pidinfo == NULL) {
+		lock_release(pid_lock);
 		*result = ESRCH;
 		return true;
 	}
 
-	return false;
+	// if valid, check if we are allowed to wait it
+	if (pidinfo->pexited || proc->pid != pidinfo->ppid) {
+		lock_release(pid_lock);
+		*result = ECHILD;
+		return true;
+	}
+
+	// wait for children processing; only we can free its slot
+	while (!pidinfo->cexited) {
+		cv_wait(pid_table[proc->pid % PID_SLOTS].waitcv, pid_lock);
+	}
+	*exitstatus = pidinfo->exitcode;
+
+	// reaped, the pid can go to somebody else
+	pidinfo_unlink(pidinfo);
+	pidinfo_free(pidinfo);
 
+	lock_release(pid_lock);
+	return false;
 }
+#endif /* OPT_A3 */
 
 void
 pid_exit(struct proc *proc, int exitcode)
 {
 	lock_acquire(pid_lock);
-	
-	unsigned np = array_num(proc_array);
-	for (unsigned i = 0; i < np; i++) {
-		struct pidinfo *pidinfo = (struct pidinfo *) array_get(proc_array, i);
-
-		// check if this is a parent process
-		if (proc->pid == pidinfo->ppid) {
-			// set exit
-			// we don't need to fill the  exitcode here,
-			// because no one cares
-			pidinfo->pexited = true;
-			// children exit as well, reuse its pid
-			if (pidinfo->cexited) {
-				P(pid_sem);
-
-				pid_t *newpid = kmalloc(sizeof(pid_t));
-				*newpid = pidinfo->pid;
-				array_add(pid_array, (void *) newpid, NULL);
-
-				V(pid_sem);
-
-				// free the original one
-				kfree(pidinfo);
-
-				array_remove(proc_array, i);
-				np--;				
-				// this index will be replaced by other, so decrement
-				i--;
-
-			}
-			
-		}
-		// check if this is a children process
-		else if (proc->pid == pidinfo->pid) {
-			pidinfo->cexited = true;
-			// its parent also exit
-			if (pidinfo->pexited) {
-				P(pid_sem);
-
-				pid_t *newpid = kmalloc(sizeof(pid_t));
-				*newpid = pidinfo->pid;
-				array_add(pid_array, (void *) newpid, NULL);
-			
-				V(pid_sem);
-
-				kfree(pidinfo);
-
-				array_remove(proc_array, i);
-				np--;
-				i--;
-			} 
-			// its parent still processing
-			else {
-				// set the real exitcode
-				pidinfo->exitcode = _MKWAIT_EXIT(exitcode);
-				cv_broadcast(pid_cv, pid_lock);
-			}
+
+	struct pidinfo *pidinfo = pidinfo_get(proc->pid);
+	if (pidinfo == NULL) {
+		lock_release(pid_lock);
+		return;
+	}
+
+	// orphan our children, and reap the ones that exited already
+	while (pidinfo->children != NULL) {
+		struct pidinfo *child = pidinfo->children;
+
+		pidinfo_unlink(child);
+		// we don't need to fill the  exitcode here,
+		// because no one cares
+		child->pexited = true;
+		if (child->cexited) {
+			pidinfo_free(child);
 		}
 	}
 
+	pidinfo->cexited = true;
+	// its parent also exit
+	if (pidinfo->pexited) {
+		pidinfo_free(pidinfo);
+	}
+	// its parent still processing
+	else {
+		// set the real exitcode, and wake up just the parent
+		pidinfo->exitcode = _MKWAIT_EXIT(exitcode);
+		cv_broadcast(pid_table[pidinfo->ppid % PID_SLOTS].waitcv,
+			     pid_lock);
+	}
+
 	lock_release(pid_lock);
 }
 
@@ -185,7 +358,7 @@ int
 pid_fork(struct trapframe *tf, pid_t *retval, struct proc *proc)
 {
 	// create a new address space for new process
-	struct addrspace *nas;
+	struct addrspace *nas = NULL;
 	// create a new process
 	struct proc *nproc = proc_create_runprogram(proc->p_name);
 	
@@ -194,66 +367,77 @@ pid_fork(struct trapframe *tf, pid_t *retval, struct proc *proc)
 		return(ENOMEM);
 	}
 
-	// check if pid proceed its maximum
-	if (nproc->pid > PID_MAX) {
+	// check if we ran out of pids
+	if (nproc->pid == 0) {
 		proc_destroy(nproc);
-		P(pid_sem);
-		
-		nextpid--;
-		
-		V(pid_sem);
 		
 		// coz now doing system call 
 		return(ENPROC);
 	}
 
 	// copy parent's trap frame, and pass it to children
+#if OPT_A3
+	struct trapframe *ntf = kmem_cache_alloc(&trapframe_cache);
+#else
 	struct trapframe *ntf = kmalloc(sizeof(*ntf));
+#endif /* OPT_A3 */
 	// check the new trapframe is valid
 	if (ntf == NULL) {
-		P(pid_sem);
-		
-		nextpid--;
-
-		V(pid_sem);
+		pid_release(nproc);
 		proc_destroy(nproc);
 		return(ENOMEM);
 	}
 	memcpy(ntf, tf, sizeof(*ntf));
 
 	// copy parent's address space
-	// for match the error number
-	int errno = as_copy(proc->p_addrspace, &nas);
-	if (errno == ENOMEM) {
-		P(pid_sem);
-		
-		nextpid--;
-		
-		V(pid_sem);
+	int result = as_copy(proc->p_addrspace, &nas);
+	if (result) {
+#if OPT_A3
+		kmem_cache_free(&trapframe_cache, ntf);
+#else
+		kfree(ntf);
+#endif /* OPT_A3 */
+		pid_release(nproc);
 		proc_destroy(nproc);
-		return(errno);
+		return(result);
 	}
 	nproc->p_addrspace = nas;
 
-	// add the new process with pid into the proc_array
+	// the child shares our open files
+	fdtable_copy(proc->p_fdtable, nproc->p_fdtable);
+
+	// make the new process our child
 	lock_acquire(pid_lock);
 
-	struct pidinfo *pidinfo = pidinfo_create(nproc->pid, proc->pid);
-	array_add(proc_array, pidinfo, NULL);
+	struct pidinfo *pidinfo = pidinfo_get(nproc->pid);
+	struct pidinfo *parent = pidinfo_get(proc->pid);
+	KASSERT(pidinfo != NULL);
+	// a parent that got no pid can't wait for anybody
+	if (parent != NULL) {
+		pidinfo->ppid = proc->pid;
+		pidinfo->pexited = false;
+		pidinfo->sibling = parent->children;
+		pidinfo->psibling = &parent->children;
+		if (parent->children != NULL) {
+			parent->children->psibling = &pidinfo->sibling;
+		}
+		parent->children = pidinfo;
+	}
 
 	lock_release(pid_lock);
 
 	// create child thread
-	errno = thread_fork("thread_fork", nproc, enter_forked_process, (void *) ntf, (int) nproc->pid);
+	result = thread_fork("thread_fork", nproc, enter_forked_process, (void *) ntf, (int) nproc->pid);
 	// check if forked thread is valid
-	if (errno == ENOMEM) {
-		P(pid_sem);
-		
-		nextpid--;
-
-		V(pid_sem);
+	if (result) {
+#if OPT_A3
+		kmem_cache_free(&trapframe_cache, ntf);
+#else
+		kfree(ntf);
+#endif /* OPT_A3 */
+		pid_release(nproc);
 		proc_destroy(nproc);
-		return(errno);
+		return(result);
 	}
 
 	// parent returns with child's pid immediately
@@ -56,14 +56,25 @@
 #if OPT_A2
 #include <limits.h>
 #include <pid.h>
+#include <file.h>
 #include <kern/errno.h>
 #include <kern/wait.h>
 #endif /* OPT_A2 */
+#include "opt-A3.h"
+#if OPT_A3
+#include <kmem.h>
+#endif /* OPT_A3 */
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+#if OPT_A3
+/* Object cache for struct proc. */
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc));
+#endif /* OPT_A3 */
+
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
  */
@@ -87,13 +98,21 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
+#if OPT_A3
+	proc = kmem_cache_alloc(&proc_cache);
+#else
 	proc = kmalloc(sizeof(*proc));
+#endif /* OPT_A3 */
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
+#if OPT_A3
+		kmem_cache_free(&proc_cache, proc);
+#else
 		kfree(proc);
+#endif /* OPT_A3 */
 		return NULL;
 	}
 
@@ -110,6 +129,10 @@ proc_create(const char *name)
 	proc->console = NULL;
 #endif // UW
 
+#if OPT_A2
+	proc->p_fdtable = NULL;
+#endif /* OPT_A2 */
+
 	return proc;
 }
 
@@ -138,6 +161,12 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+#if OPT_A2
+	if (proc->p_fdtable) {
+		fdtable_destroy(proc->p_fdtable);
+		proc->p_fdtable = NULL;
+	}
+#endif /* OPT_A2 */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
@@ -173,7 +202,11 @@ proc_destroy(struct proc *proc)
 	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
+#if OPT_A3
+	kmem_cache_free(&proc_cache, proc);
+#else
 	kfree(proc);
+#endif /* OPT_A3 */
 
 #ifdef UW
 	/* decrement the process count */
@@ -286,6 +319,16 @@ proc_create_runprogram(const char *name)
 
 #endif // UW
 
+#if OPT_A2
+	/* runprogram opens stdio in here, pid_fork copies the parent's */
+	proc->p_fdtable = fdtable_create();
+	if (proc->p_fdtable == NULL) {
+		pid_release(proc);
+		proc_destroy(proc);
+		return NULL;
+	}
+#endif /* OPT_A2 */
+
 	return proc;
 }
 
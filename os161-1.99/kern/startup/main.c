@@ -50,6 +50,11 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-A3.h"
+#include "opt-dumbvm.h"
+#if OPT_A3 && !OPT_DUMBVM
+#include <uw-vmstats.h>
+#endif /* OPT_A3 && !OPT_DUMBVM */
 
 
 /*
@@ -153,6 +158,10 @@ shutdown(void)
 
 	thread_shutdown();
 
+#if OPT_A3 && !OPT_DUMBVM
+	vmstats_print();
+#endif /* OPT_A3 && !OPT_DUMBVM */
+
 	splhigh();
 }
 
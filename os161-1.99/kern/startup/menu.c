@@ -42,11 +42,14 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <iosched.h>
+#include <namecache.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -391,6 +394,54 @@ cmd_bootfs(int nargs, char **args)
 	return vfs_setbootfs(device);
 }
 
+#if OPT_A3
+/*
+ * Command for showing or choosing the I/O scheduling policy.
+ */
+static
+int
+cmd_iosched(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kprintf("I/O scheduler: %s\n", iosched_getpolicy());
+		return 0;
+	}
+	if (nargs != 2 || iosched_setpolicy(args[1])) {
+		kprintf("Usage: ios [fifo|cscan|deadline]\n");
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Command for showing the most contended spinlocks.
+ */
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	spinlock_printstats();
+	return 0;
+}
+
+/*
+ * Command for showing the name cache's hit and miss counts.
+ */
+static
+int
+cmd_namecache(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	namecache_printstats();
+	return 0;
+}
+#endif /* OPT_A3 */
+
 static
 int
 cmd_kheapstats(int nargs, char **args)
@@ -458,6 +509,11 @@ static const char *opsmenu[] = {
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	"[dth]     Enable the output of DB_THREADS",
+#if OPT_A3
+	"[ios]     Show/set I/O scheduler     ",
+	"[lks]     Spinlock contention stats  ",
+	"[ncs]     Name cache stats           ",
+#endif /* OPT_A3 */
 	NULL
 };
 
@@ -477,6 +533,9 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+#if OPT_A3
+	"[pgb] Page allocator benchmark      ",
+#endif /* OPT_A3 */
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -486,6 +545,10 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+#if OPT_A3
+	"[sy4] Rwlock test                   ",
+	"[sy5] Epoch test                    ",
+#endif /* OPT_A3 */
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -583,12 +646,20 @@ static struct {
 	/* stats */
 	{ "kh",         cmd_kheapstats },
 	{"dth",         cmd_outputdbthreads },
+#if OPT_A3
+	{ "ios",	cmd_iosched },
+	{ "lks",	cmd_lockstats },
+	{ "ncs",	cmd_namecache },
+#endif /* OPT_A3 */
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+#if OPT_A3
+	{ "pgb",	pagebench },
+#endif /* OPT_A3 */
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -600,6 +671,10 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+#if OPT_A3
+	{ "sy4",	rwtest },
+	{ "sy5",	epochtest },
+#endif /* OPT_A3 */
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
@@ -0,0 +1,227 @@
+#include "opt-A2.h"
+
+#if OPT_A2
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <vfs.h>
+#include <file.h>
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct openfile *of;
+	struct vnode *vn;
+	int result;
+
+	result = vfs_open(path, flags, mode, &vn);
+	if (result) {
+		return result;
+	}
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		vfs_close(vn);
+		return ENOMEM;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		vfs_close(vn);
+		return ENOMEM;
+	}
+	of->of_vnode = vn;
+	of->of_flags = flags;
+	of->of_offset = 0;
+	of->of_refcount = 1;
+	spinlock_init(&of->of_reflock);
+
+	*ret = of;
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	unsigned refs;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	refs = --of->of_refcount;
+	spinlock_release(&of->of_reflock);
+
+	if (refs > 0) {
+		return;
+	}
+
+	// last descriptor gone, nobody else can reach it
+	vfs_close(of->of_vnode);
+	lock_destroy(of->of_lock);
+	spinlock_cleanup(&of->of_reflock);
+	kfree(of);
+}
+
+struct fdtable *
+fdtable_create(void)
+{
+	struct fdtable *fdt = kmalloc(sizeof(*fdt));
+	if (fdt == NULL) {
+		return NULL;
+	}
+
+	for (int i = 0; i < OPEN_MAX; i++) {
+		fdt->fd_files[i] = NULL;
+	}
+	spinlock_init(&fdt->fd_lock);
+	return fdt;
+}
+
+/*
+ * Open the console as stdin, stdout and stderr.
+ */
+static const int stdio_modes[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+
+int
+fdtable_stdio(struct fdtable *fdt)
+{
+	char path[5];
+	struct openfile *of;
+	int result;
+
+	for (int fd = 0; fd < 3; fd++) {
+		// vfs_open chews up the path
+		strcpy(path, "con:");
+		result = openfile_open(path, stdio_modes[fd], 0, &of);
+		if (result) {
+			return result;
+		}
+		of = fd_replace(fdt, fd, of);
+		if (of != NULL) {
+			openfile_decref(of);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Fill NEW, which is empty, with OLD's descriptors. They end up
+ * sharing the open files, offsets and all.
+ */
+void
+fdtable_copy(struct fdtable *old, struct fdtable *new)
+{
+	spinlock_acquire(&old->fd_lock);
+	for (int i = 0; i < OPEN_MAX; i++) {
+		KASSERT(new->fd_files[i] == NULL);
+		if (old->fd_files[i] != NULL) {
+			openfile_incref(old->fd_files[i]);
+			new->fd_files[i] = old->fd_files[i];
+		}
+	}
+	spinlock_release(&old->fd_lock);
+}
+
+void
+fdtable_destroy(struct fdtable *fdt)
+{
+	for (int i = 0; i < OPEN_MAX; i++) {
+		if (fdt->fd_files[i] != NULL) {
+			openfile_decref(fdt->fd_files[i]);
+		}
+	}
+	spinlock_cleanup(&fdt->fd_lock);
+	kfree(fdt);
+}
+
+// put OF in the lowest free descriptor; the table takes our reference
+int
+fd_alloc(struct fdtable *fdt, struct openfile *of, int *ret)
+{
+	spinlock_acquire(&fdt->fd_lock);
+	for (int i = 0; i < OPEN_MAX; i++) {
+		if (fdt->fd_files[i] == NULL) {
+			fdt->fd_files[i] = of;
+			spinlock_release(&fdt->fd_lock);
+			*ret = i;
+			return 0;
+		}
+	}
+	spinlock_release(&fdt->fd_lock);
+	return EMFILE;
+}
+
+/*
+ * Make FD refer to OF (NULL closes it), and hand back the reference
+ * to what it referred to before, if anything.
+ */
+struct openfile *
+fd_replace(struct fdtable *fdt, int fd, struct openfile *of)
+{
+	struct openfile *old;
+
+	KASSERT(fd >= 0 && fd < OPEN_MAX);
+
+	spinlock_acquire(&fdt->fd_lock);
+	old = fdt->fd_files[fd];
+	fdt->fd_files[fd] = of;
+	spinlock_release(&fdt->fd_lock);
+	return old;
+}
+
+/*
+ * Look up descriptor FD of P, or NULL if it isn't open. A process
+ * with a single thread, looking at its own table, has nobody to race
+ * with: its descriptors can only be closed by that thread, so the
+ * open file is used as it is, without fd_lock or a reference.
+ * Otherwise a reference is taken. Either way, hand it back to fd_put
+ * along with *HELD.
+ */
+struct openfile *
+fd_get(struct proc *p, int fd, bool *held)
+{
+	struct fdtable *fdt = p->p_fdtable;
+	struct openfile *of;
+
+	*held = false;
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return NULL;
+	}
+
+	if (p == curproc && threadarray_num(&p->p_threads) == 1) {
+		return fdt->fd_files[fd];
+	}
+
+	spinlock_acquire(&fdt->fd_lock);
+	of = fdt->fd_files[fd];
+	if (of != NULL) {
+		openfile_incref(of);
+		*held = true;
+	}
+	spinlock_release(&fdt->fd_lock);
+	return of;
+}
+
+void
+fd_put(struct openfile *of, bool held)
+{
+	if (held) {
+		openfile_decref(of);
+	}
+}
+
+#endif /* OPT_A2 */
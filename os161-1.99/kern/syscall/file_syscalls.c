@@ -9,6 +9,484 @@
 #include <current.h>
 #include <proc.h>
 
+#include "opt-A2.h"
+#if OPT_A2
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <limits.h>
+#include <stat.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <file.h>
+#endif /* OPT_A2 */
+
+#if OPT_A2
+/*
+ * File system calls. Descriptors index the process's fdtable; the
+ * open file behind one carries the offset, under its own lock, so
+ * processes that share it through fork see each other's reads and
+ * writes move it.
+ */
+
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+  struct openfile *of;
+  char *path;
+  int result;
+
+  if ((flags & O_ACCMODE) == O_ACCMODE) {
+    return EINVAL;
+  }
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr((const_userptr_t)upath, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+
+  result = openfile_open(path, flags, mode, &of);
+  kfree(path);
+  if (result) {
+    return result;
+  }
+
+  result = fd_alloc(curproc->p_fdtable, of, retval);
+  if (result) {
+    openfile_decref(of);
+    return result;
+  }
+  return 0;
+}
+
+/* largest transfer whose size fits in the return value */
+#define FILE_IO_MAX 0x7fffffff
+
+/*
+ * Move data between the user buffers IOV[0..IOVCNT-1] and a file.
+ * Plain I/O starts at the open file's offset and moves it; with
+ * POSITIONED set it starts at POS and leaves the offset alone, so it
+ * doesn't need the open file's lock either.
+ */
+static
+int
+file_io(int fdesc, struct iovec *iov, int iovcnt, bool positioned, off_t pos,
+	enum uio_rw rw, int *retval)
+{
+  struct openfile *of;
+  struct uio u;
+  struct stat st;
+  size_t nbytes;
+  bool held;
+  int acc, res;
+
+  /* total length; it has to fit in the return value */
+  nbytes = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > FILE_IO_MAX - nbytes) {
+      return EINVAL;
+    }
+    nbytes += iov[i].iov_len;
+  }
+
+  of = fd_get(curproc, fdesc, &held);
+  if (of == NULL) {
+    return EBADF;
+  }
+  acc = of->of_flags & O_ACCMODE;
+  if ((rw == UIO_READ && acc == O_WRONLY) ||
+      (rw == UIO_WRITE && acc == O_RDONLY)) {
+    fd_put(of, held);
+    return EBADF;
+  }
+
+  if (positioned) {
+    /* the console and other devices have no positions */
+    res = pos < 0 ? EINVAL : VOP_TRYSEEK(of->of_vnode, pos);
+    if (res) {
+      fd_put(of, held);
+      return res;
+    }
+  }
+  else {
+    lock_acquire(of->of_lock);
+    if (rw == UIO_WRITE && (of->of_flags & O_APPEND)) {
+      res = VOP_STAT(of->of_vnode, &st);
+      if (res) {
+        lock_release(of->of_lock);
+        fd_put(of, held);
+        return res;
+      }
+      of->of_offset = st.st_size;
+    }
+    pos = of->of_offset;
+  }
+
+  /* set up a uio structure to refer to the user program's buffers */
+  u.uio_iov = iov;
+  u.uio_iovcnt = iovcnt;
+  u.uio_offset = pos;
+  u.uio_resid = nbytes;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = rw;
+  u.uio_space = curproc->p_addrspace;
+
+  if (rw == UIO_READ) {
+    res = VOP_READ(of->of_vnode, &u);
+  }
+  else {
+    res = VOP_WRITE(of->of_vnode, &u);
+  }
+  if (res == 0) {
+    /* pass back the number of bytes actually moved */
+    *retval = nbytes - u.uio_resid;
+  }
+
+  if (!positioned) {
+    if (res == 0) {
+      of->of_offset = u.uio_offset;
+    }
+    lock_release(of->of_lock);
+  }
+  fd_put(of, held);
+  return res;
+}
+
+/* read() and write(): one user buffer */
+static
+int
+file_rw(int fdesc, userptr_t ubuf, size_t nbytes, bool positioned, off_t pos,
+	enum uio_rw rw, int *retval)
+{
+  struct iovec iov;
+
+  iov.iov_ubase = ubuf;
+  iov.iov_len = nbytes;
+  return file_io(fdesc, &iov, 1, positioned, pos, rw, retval);
+}
+
+/* readv() and writev(): one copyin of the user's iovec array */
+static
+int
+file_rwv(int fdesc, userptr_t uiov, int iovcnt, enum uio_rw rw, int *retval)
+{
+  struct iovec *iov;
+  int res;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
+  }
+  iov = kmalloc(iovcnt * sizeof(struct iovec));
+  if (iov == NULL) {
+    return ENOMEM;
+  }
+  res = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(struct iovec));
+  if (res == 0) {
+    res = file_io(fdesc, iov, iovcnt, false, 0, rw, retval);
+  }
+  kfree(iov);
+  return res;
+}
+
+int
+sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return file_rw(fdesc, ubuf, nbytes, false, 0, UIO_READ, retval);
+}
+
+int
+sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
+{
+  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
+  return file_rw(fdesc, ubuf, nbytes, false, 0, UIO_WRITE, retval);
+}
+
+int
+sys_pread(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  return file_rw(fdesc, ubuf, nbytes, true, pos, UIO_READ, retval);
+}
+
+int
+sys_pwrite(int fdesc, userptr_t ubuf, size_t nbytes, off_t pos, int *retval)
+{
+  return file_rw(fdesc, ubuf, nbytes, true, pos, UIO_WRITE, retval);
+}
+
+int
+sys_readv(int fdesc, userptr_t uiov, int iovcnt, int *retval)
+{
+  return file_rwv(fdesc, uiov, iovcnt, UIO_READ, retval);
+}
+
+int
+sys_writev(int fdesc, userptr_t uiov, int iovcnt, int *retval)
+{
+  return file_rwv(fdesc, uiov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * Bytes sendfile moves per VOP_READ/VOP_WRITE. A multiple of the file
+ * system block size; chunks start on a chunk boundary of the input, so
+ * after the first one sfs reads whole blocks straight out of its cache.
+ */
+#define SENDFILE_CHUNK 8192
+
+/*
+ * Move data between two open files through a kernel buffer, so none
+ * of it is copied in or out of user space. Both open files are locked
+ * for the whole transfer, in address order so that two opposite
+ * transfers cannot deadlock.
+ */
+static
+int
+file_sendfile(struct openfile *out, struct openfile *in, bool positioned,
+	      off_t *inpos, size_t len, int *retval)
+{
+  struct openfile *first, *second;
+  struct iovec iov;
+  struct uio u;
+  struct stat st;
+  off_t rpos, wpos;
+  size_t total, n, got;
+  char *buf;
+  int res;
+
+  buf = kmalloc(SENDFILE_CHUNK);
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+
+  first = out < in ? out : in;
+  second = out < in ? in : out;
+  if (!positioned || first == out) {
+    lock_acquire(first->of_lock);
+  }
+  if (!positioned || second == out) {
+    lock_acquire(second->of_lock);
+  }
+
+  res = 0;
+  if (out->of_flags & O_APPEND) {
+    res = VOP_STAT(out->of_vnode, &st);
+    if (res == 0) {
+      out->of_offset = st.st_size;
+    }
+  }
+  rpos = positioned ? *inpos : in->of_offset;
+  wpos = out->of_offset;
+
+  total = 0;
+  while (res == 0 && total < len) {
+    n = SENDFILE_CHUNK - (rpos % SENDFILE_CHUNK);
+    if (n > len - total) {
+      n = len - total;
+    }
+
+    uio_kinit(&iov, &u, buf, n, rpos, UIO_READ);
+    res = VOP_READ(in->of_vnode, &u);
+    got = n - u.uio_resid;
+    if (res || got == 0) {
+      break;
+    }
+
+    uio_kinit(&iov, &u, buf, got, wpos, UIO_WRITE);
+    res = VOP_WRITE(out->of_vnode, &u);
+    got -= u.uio_resid;
+    rpos += got;
+    wpos += got;
+    total += got;
+    if (u.uio_resid > 0) {
+      // out of space; report what made it
+      break;
+    }
+  }
+
+  // like read and write, a partial transfer is not an error
+  if (total > 0) {
+    res = 0;
+  }
+  if (res == 0) {
+    if (positioned) {
+      *inpos = rpos;
+    }
+    else {
+      in->of_offset = rpos;
+    }
+    out->of_offset = wpos;
+    *retval = total;
+  }
+
+  if (!positioned || second == out) {
+    lock_release(second->of_lock);
+  }
+  if (!positioned || first == out) {
+    lock_release(first->of_lock);
+  }
+  kfree(buf);
+  return res;
+}
+
+/*
+ * sendfile(outfd, infd, offset, len): copy up to LEN bytes from INFD to
+ * OUTFD. With OFFSET NULL the input starts at, and moves, its open
+ * file's offset; otherwise it starts at *OFFSET, which is updated, and
+ * the open file's offset is left alone. Returns the bytes moved, 0 at
+ * end of file.
+ */
+int
+sys_sendfile(int outfd, int infd, userptr_t uoffset, size_t len, int *retval)
+{
+  struct openfile *out, *in;
+  bool outheld, inheld;
+  off_t pos = 0;
+  int res;
+
+  if (len > FILE_IO_MAX) {
+    len = FILE_IO_MAX;
+  }
+  if (uoffset != NULL) {
+    res = copyin((const_userptr_t)uoffset, &pos, sizeof(off_t));
+    if (res) {
+      return res;
+    }
+  }
+
+  in = fd_get(curproc, infd, &inheld);
+  if (in == NULL) {
+    return EBADF;
+  }
+  out = fd_get(curproc, outfd, &outheld);
+  if (out == NULL) {
+    fd_put(in, inheld);
+    return EBADF;
+  }
+
+  if ((in->of_flags & O_ACCMODE) == O_WRONLY ||
+      (out->of_flags & O_ACCMODE) == O_RDONLY) {
+    res = EBADF;
+  }
+  else if (in == out) {
+    // its one offset can't be both the source and the destination
+    res = EINVAL;
+  }
+  else if (uoffset != NULL) {
+    res = pos < 0 ? EINVAL : VOP_TRYSEEK(in->of_vnode, pos);
+  }
+  else {
+    res = 0;
+  }
+
+  if (res == 0) {
+    res = file_sendfile(out, in, uoffset != NULL, &pos, len, retval);
+  }
+  if (res == 0 && uoffset != NULL) {
+    res = copyout(&pos, uoffset, sizeof(off_t));
+  }
+
+  fd_put(out, outheld);
+  fd_put(in, inheld);
+  return res;
+}
+
+int
+sys_close(int fdesc)
+{
+  struct openfile *of;
+
+  if (fdesc < 0 || fdesc >= OPEN_MAX) {
+    return EBADF;
+  }
+  of = fd_replace(curproc->p_fdtable, fdesc, NULL);
+  if (of == NULL) {
+    return EBADF;
+  }
+  openfile_decref(of);
+  return 0;
+}
+
+int
+sys_lseek(int fdesc, off_t pos, int whence, off_t *retval)
+{
+  struct openfile *of;
+  struct stat st;
+  off_t newpos;
+  bool held;
+  int res;
+
+  of = fd_get(curproc, fdesc, &held);
+  if (of == NULL) {
+    return EBADF;
+  }
+
+  lock_acquire(of->of_lock);
+  switch (whence) {
+  case SEEK_SET:
+    newpos = pos;
+    res = 0;
+    break;
+  case SEEK_CUR:
+    newpos = of->of_offset + pos;
+    res = 0;
+    break;
+  case SEEK_END:
+    res = VOP_STAT(of->of_vnode, &st);
+    newpos = st.st_size + pos;
+    break;
+  default:
+    res = EINVAL;
+    break;
+  }
+  if (res == 0 && newpos < 0) {
+    res = EINVAL;
+  }
+  if (res == 0) {
+    /* the console and other devices can't seek */
+    res = VOP_TRYSEEK(of->of_vnode, newpos);
+  }
+  if (res == 0) {
+    of->of_offset = newpos;
+    *retval = newpos;
+  }
+  lock_release(of->of_lock);
+
+  fd_put(of, held);
+  return res;
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+  struct openfile *of, *old;
+  bool held;
+
+  if (newfd < 0 || newfd >= OPEN_MAX) {
+    return EBADF;
+  }
+  of = fd_get(curproc, oldfd, &held);
+  if (of == NULL) {
+    return EBADF;
+  }
+
+  if (oldfd != newfd) {
+    openfile_incref(of);
+    old = fd_replace(curproc->p_fdtable, newfd, of);
+    if (old != NULL) {
+      openfile_decref(old);
+    }
+  }
+
+  fd_put(of, held);
+  *retval = newfd;
+  return 0;
+}
+
+#else
 /* handler for write() system call                  */
 /*
  * n.b.
@@ -58,3 +536,4 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
   KASSERT(*retval >= 0);
   return 0;
 }
+#endif /* OPT_A2 */
@@ -61,6 +61,7 @@
 #include <elf.h>
 
 #include "opt-A3.h"
+#include "opt-dumbvm.h"
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -83,6 +84,19 @@ load_segment(struct addrspace *as, struct vnode *v,
 	     size_t memsize, size_t filesize,
 	     int is_executable)
 {
+#if OPT_A3 && !OPT_DUMBVM
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n", 
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	// nothing is read now, vm_fault pulls each page in on first touch
+	(void)is_executable;
+	return as_define_file(as, v, offset, vaddr, filesize);
+#else
 	struct iovec iov;
 	struct uio u;
 	int result;
@@ -95,7 +109,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
-#if OPT_A3
+#if OPT_A3 && OPT_DUMBVM
 	// avoid the fail of implementing the read-only text segments
 	paddr_t paddr;
 	vaddr_t vbase1, vtop1, vbase2, vtop2;
@@ -148,7 +162,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
-#endif /* OPT_A3 */
+#endif /* OPT_A3 && OPT_DUMBVM */
 
 	result = VOP_READ(v, &u);
 	if (result) {
@@ -190,6 +204,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 #endif
 	
 	return result;
+#endif /* OPT_A3 && !OPT_DUMBVM */
 }
 
 /*
@@ -0,0 +1,95 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <file.h>
+
+#include "opt-A3.h"
+
+#if OPT_A3
+/*
+ * sbrk: move the break, the top of the heap region as_complete_load
+ * put above the program's segments. Returns the old break.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+  return as_sbrk(curproc_getas(), amount, retval);
+}
+
+/*
+ * Memory-mapped files. A mapping is a region of the address space
+ * backed by the file's vnode (see as_map_file); vm_fault reads its
+ * pages in as they are touched, and stores to a MAP_SHARED mapping go
+ * back to the file at msync, munmap and exit. A forked child shares a
+ * MAP_SHARED mapping's pages with its parent; see <kern/mman.h> for
+ * what separate mappings of one file see.
+ */
+
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fdesc,
+         off_t offset, vaddr_t *retval)
+{
+  struct openfile *of;
+  bool held, shared, writeable;
+  int acc, res;
+
+  // the address is only a hint, and we don't take hints
+  (void)addr;
+
+  if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+    return EINVAL;
+  }
+  if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+    return EINVAL;
+  }
+  if (len == 0 || offset < 0 || (offset & ~(off_t)PAGE_FRAME) != 0) {
+    return EINVAL;
+  }
+  shared = flags == MAP_SHARED;
+  writeable = (prot & PROT_WRITE) != 0;
+
+  of = fd_get(curproc, fdesc, &held);
+  if (of == NULL) {
+    return EBADF;
+  }
+  acc = of->of_flags & O_ACCMODE;
+  if (acc == O_WRONLY || (shared && writeable && acc != O_RDWR)) {
+    fd_put(of, held);
+    return EACCES;
+  }
+
+  res = VOP_MMAP(of->of_vnode);
+  if (res == 0) {
+    res = as_map_file(curproc_getas(), of->of_vnode, offset, len,
+                      writeable, shared, retval);
+  }
+  fd_put(of, held);
+  return res;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+  return as_unmap(curproc_getas(), (vaddr_t)addr, len);
+}
+
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+  // either way, the pages are written back before we return
+  if (flags != MS_ASYNC && flags != MS_SYNC) {
+    return EINVAL;
+  }
+  if (((vaddr_t)addr & ~(vaddr_t)PAGE_FRAME) != 0) {
+    return EINVAL;
+  }
+  return as_sync(curproc_getas(), (vaddr_t)addr, len);
+}
+#endif /* OPT_A3 */
@@ -206,12 +206,22 @@ sys_execv(char *progname, char **uargs)
 	}
 
 	/* Switch to it and activate it. */
+#if OPT_A3
+	struct addrspace *oas = curproc_setas(as);
+#else
 	curproc_setas(as);
+#endif /* OPT_A3 */
 	as_activate();
 
 	/* Load the executable. */
 	result = load_elf(v, &entrypoint);
 	if (result) {
+#if OPT_A3
+		// go back to the old image so the caller still has somewhere to return
+		curproc_setas(oas);
+		as_activate();
+		as_destroy(as);
+#endif /* OPT_A3 */
 		/* p_addrspace will go away when curproc is destroyed */
 		vfs_close(v);
 		return result;
@@ -220,6 +230,11 @@ sys_execv(char *progname, char **uargs)
 	/* Done with the file now. */
 	vfs_close(v);
 
+#if OPT_A3
+	// the old image is unreachable now, give its pages back
+	as_destroy(oas);
+#endif /* OPT_A3 */
+
 
 	// copy the arguments from kernel buffer into user stack
 	/* use as_define_stack to get the value of initial stack pointer */
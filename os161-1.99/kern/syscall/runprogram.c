@@ -48,6 +48,7 @@
 #include "opt-A2.h"
 #if OPT_A2
 #include <copyinout.h>
+#include <file.h>
 #endif /* OPT_A2*/
 /*
  * Load program "progname" and start running it in usermode.
@@ -67,6 +68,14 @@ runprogram(char *progname)
 	vaddr_t entrypoint, stackptr;
 	int result;
 
+#if OPT_A2
+	/* Set up stdin, stdout and stderr on the console. */
+	result = fdtable_stdio(curproc->p_fdtable);
+	if (result) {
+		return result;
+	}
+#endif /* OPT_A2*/
+
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
@@ -35,6 +35,14 @@
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <clock.h>
+#include <vm.h>
+#include <coremap.h>
+#include <cpu.h>
+#include <kmem.h>
+#endif /* OPT_A3 */
 
 /*
  * Test kmalloc; allocate ITEMSIZE bytes NTRIES times, freeing
@@ -103,6 +111,10 @@ malloctest(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_A3
+static void kmbench(void);
+#endif /* OPT_A3 */
+
 int
 mallocstress(int nargs, char **args)
 {
@@ -135,5 +147,213 @@ mallocstress(int nargs, char **args)
 	sem_destroy(sem);
 	kprintf("kmalloc stress test done\n");
 
+#if OPT_A3
+	kmbench();
+#endif /* OPT_A3 */
+
+	return 0;
+}
+
+#if OPT_A3
+/*
+ * Allocator benchmarks. Each runs NTHREADS-many threads that each
+ * allocate and free PAIRS objects, and reports how long that took;
+ * allocbench_run does the timing and reporting for both.
+ */
+struct allocbench {
+	struct semaphore *ab_sem;	/* V'd by each thread when done */
+	struct kmem_cache *ab_cache;	/* kmbench: or NULL for kmalloc */
+};
+
+static
+void
+allocbench_run(const char *what, unsigned nthreads,
+	       void (*func)(void *, unsigned long), struct allocbench *ab,
+	       unsigned pairs)
+{
+	time_t beforesecs, aftersecs, secs;
+	uint32_t beforensecs, afternsecs, nsecs;
+	uint64_t npairs, nanos;
+	unsigned i;
+	int result;
+
+	ab->ab_sem = sem_create("allocbench", 0);
+	if (ab->ab_sem == NULL) {
+		panic("allocbench: sem_create failed\n");
+	}
+
+	gettime(&beforesecs, &beforensecs);
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("allocbench", NULL, func, ab, i);
+		if (result) {
+			panic("allocbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	for (i=0; i<nthreads; i++) {
+		P(ab->ab_sem);
+	}
+
+	gettime(&aftersecs, &afternsecs);
+	getinterval(beforesecs, beforensecs, aftersecs, afternsecs,
+		    &secs, &nsecs);
+	sem_destroy(ab->ab_sem);
+
+	npairs = (uint64_t)nthreads * pairs;
+	nanos = (uint64_t)secs * 1000000000 + nsecs;
+	kprintf("%s, %u thread%s: %llu alloc/free pairs in %lu.%09lu seconds",
+		what, nthreads, nthreads == 1 ? "" : "s", npairs,
+		(unsigned long) secs, (unsigned long) nsecs);
+	if (nanos > 0) {
+		kprintf(" (%llu pairs/sec)", npairs * 1000000000 / nanos);
+	}
+	kprintf("\n");
+}
+
+/*
+ * Page allocator benchmark: NTHREADS threads each allocate and free
+ * single pages, PAGEBENCH_BATCH at a time, first with every page going
+ * through coremap_lock and then with the per-cpu page caches on.
+ */
+
+#define PAGEBENCH_NTRIES  2000
+#define PAGEBENCH_BATCH   8
+
+static
+void
+pagebenchthread(void *abp, unsigned long num)
+{
+	struct allocbench *ab = abp;
+	vaddr_t pages[PAGEBENCH_BATCH];
+	int i, j;
+
+	for (i=0; i<PAGEBENCH_NTRIES; i++) {
+		for (j=0; j<PAGEBENCH_BATCH; j++) {
+			pages[j] = alloc_kpages(1);
+			if (pages[j] == 0) {
+				kprintf("thread %lu: alloc_kpages returned 0\n",
+					num);
+				while (j-- > 0) {
+					free_kpages(pages[j]);
+				}
+				V(ab->ab_sem);
+				return;
+			}
+		}
+		for (j=0; j<PAGEBENCH_BATCH; j++) {
+			free_kpages(pages[j]);
+		}
+	}
+	V(ab->ab_sem);
+}
+
+int
+pagebench(int nargs, char **args)
+{
+	struct allocbench ab;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting page allocator benchmark...\n");
+
+	ab.ab_cache = NULL;
+	coremap_set_pcpu(false);
+	allocbench_run("global coremap_lock", NTHREADS, pagebenchthread, &ab,
+		       PAGEBENCH_NTRIES * PAGEBENCH_BATCH);
+	coremap_set_pcpu(true);
+	allocbench_run("per-cpu page caches", NTHREADS, pagebenchthread, &ab,
+		       PAGEBENCH_NTRIES * PAGEBENCH_BATCH);
+
+	kprintf("page allocator benchmark done\n");
+
 	return 0;
 }
+
+/*
+ * Object allocator benchmark, run at the end of km2: with 1, 2, 4, ...
+ * threads, up to one per cpu, each thread allocates and frees
+ * KMBENCH_SIZE-byte objects, KMBENCH_BATCH at a time, first with
+ * kmalloc and then from a kmem cache. Throughput should go up with the
+ * thread count for the cache, whose per-cpu magazines don't share a
+ * lock, and not much for kmalloc.
+ */
+
+#define KMBENCH_NTRIES  2000
+#define KMBENCH_BATCH   8
+#define KMBENCH_SIZE    96
+
+static
+void
+kmbenchthread(void *abp, unsigned long num)
+{
+	struct allocbench *ab = abp;
+	void *objs[KMBENCH_BATCH];
+	int i, j;
+
+	for (i=0; i<KMBENCH_NTRIES; i++) {
+		for (j=0; j<KMBENCH_BATCH; j++) {
+			if (ab->ab_cache != NULL) {
+				objs[j] = kmem_cache_alloc(ab->ab_cache);
+			}
+			else {
+				objs[j] = kmalloc(KMBENCH_SIZE);
+			}
+			if (objs[j] == NULL) {
+				kprintf("thread %lu: allocation failed\n", num);
+				break;
+			}
+		}
+		while (j-- > 0) {
+			if (ab->ab_cache != NULL) {
+				kmem_cache_free(ab->ab_cache, objs[j]);
+			}
+			else {
+				kfree(objs[j]);
+			}
+		}
+	}
+	V(ab->ab_sem);
+}
+
+static
+void
+kmbench_run(const char *what, struct kmem_cache *kc, unsigned nthreads)
+{
+	struct allocbench ab;
+
+	ab.ab_cache = kc;
+	allocbench_run(what, nthreads, kmbenchthread, &ab,
+		       KMBENCH_NTRIES * KMBENCH_BATCH);
+}
+
+static
+void
+kmbench(void)
+{
+	struct kmem_cache *kc;
+	unsigned n, ncpus;
+
+	kprintf("Starting object allocator benchmark...\n");
+
+	kc = kmem_cache_create("kmbench", KMBENCH_SIZE);
+	if (kc == NULL) {
+		panic("kmbench: kmem_cache_create failed\n");
+	}
+
+	ncpus = cpu_count();
+	for (n = 1; ; n = n*2 < ncpus ? n*2 : ncpus) {
+		kmbench_run("kmalloc", NULL, n);
+		kmbench_run("kmem cache", kc, n);
+		if (n == ncpus) {
+			break;
+		}
+	}
+
+	kmem_cache_destroy(kc);
+
+	kprintf("object allocator benchmark done\n");
+}
+#endif /* OPT_A3 */
@@ -31,6 +31,8 @@
  * Synchronization test code.
  */
 
+#include "opt-A3.h"
+
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
@@ -347,3 +349,301 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+#if OPT_A3
+#define NRWREADERS    8
+#define NRWLOOPS      60
+#define NRWYIELDS     1000
+#define NEPOCHLOOPS   200
+#define EPOCH_MAGIC   0x600dbeefUL
+#define EPOCH_POISON  0xdeadbeefUL
+
+static struct rwlock *testrw;
+static struct spinlock rwtest_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwtest_inside;
+static volatile bool rwtest_writerdone;
+static volatile bool rwtest_readerin;
+static volatile bool synchtest_failed;
+
+static
+void
+testfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	synchtest_failed = true;
+}
+
+/*
+ * Reader concurrency: all the readers must get in at the same time.
+ * If read holds excluded each other, no reader would see the others
+ * arrive, however long it waited.
+ */
+static
+void
+rwsharethread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	rwlock_acquire_read(testrw);
+	spinlock_acquire(&rwtest_lock);
+	rwtest_inside++;
+	spinlock_release(&rwtest_lock);
+
+	for (i=0; i<NRWYIELDS && rwtest_inside < NRWREADERS; i++) {
+		thread_yield();
+	}
+	if (rwtest_inside < NRWREADERS) {
+		testfail(num, "readers did not hold the lock together");
+	}
+	rwlock_release_read(testrw);
+
+	V(donesem);
+}
+
+/*
+ * Writer exclusion: even threads write testval1/testval2 in two steps,
+ * yielding in between, under the write lock; odd threads check under
+ * the read lock that they never see half of an update.
+ */
+static
+void
+rwexclthread(void *junk, unsigned long num)
+{
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 2 == 0) {
+			rwlock_acquire_write(testrw);
+			KASSERT(rwlock_do_i_hold_write(testrw));
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			if (testval1 != num) {
+				testfail(num, "another writer got in");
+			}
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			KASSERT(!rwlock_do_i_hold_write(testrw));
+			if (testval2 != testval1*testval1) {
+				testfail(num, "a reader saw half an update");
+			}
+			rwlock_release_read(testrw);
+		}
+		thread_yield();
+	}
+
+	V(donesem);
+}
+
+static
+void
+rwwriterthread(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	rwlock_acquire_write(testrw);
+	if (rwtest_readerin) {
+		testfail(num, "a later reader got in before the writer");
+	}
+	rwtest_writerdone = true;
+	rwlock_release_write(testrw);
+
+	V(donesem);
+}
+
+static
+void
+rwreaderthread(void *junk, unsigned long num)
+{
+	(void)junk;
+
+	rwlock_acquire_read(testrw);
+	rwtest_readerin = true;
+	if (!rwtest_writerdone) {
+		testfail(num, "a reader got past a waiting writer");
+	}
+	rwlock_release_read(testrw);
+
+	V(donesem);
+}
+
+static
+unsigned
+rwtest_writers_waiting(void)
+{
+	unsigned n;
+
+	spinlock_acquire(&testrw->rwlock_lock);
+	n = testrw->rwlock_wwaiting;
+	spinlock_release(&testrw->rwlock_lock);
+	return n;
+}
+
+static
+void
+synchfork(const char *name, void (*func)(void *, unsigned long),
+	  unsigned long num)
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, num);
+	if (result) {
+		panic("synchtest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	if (testrw == NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+	}
+	synchtest_failed = false;
+	kprintf("Starting rwlock test...\n");
+
+	kprintf("Readers share the lock...\n");
+	rwtest_inside = 0;
+	for (i=0; i<NRWREADERS; i++) {
+		synchfork("rwtest", rwsharethread, i);
+	}
+	for (i=0; i<NRWREADERS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Writers exclude everybody...\n");
+	testval1 = 0;
+	testval2 = 0;
+	for (i=0; i<NTHREADS; i++) {
+		synchfork("rwtest", rwexclthread, i);
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	/*
+	 * Writer preference: with a reader in, a writer comes and
+	 * waits; a reader that comes after it must wait behind it.
+	 */
+	kprintf("A waiting writer goes before new readers...\n");
+	rwtest_writerdone = false;
+	rwtest_readerin = false;
+	rwlock_acquire_read(testrw);
+	synchfork("rwtest", rwwriterthread, 0);
+	while (rwtest_writers_waiting() == 0) {
+		thread_yield();
+	}
+	synchfork("rwtest", rwreaderthread, 1);
+	for (i=0; i<NRWYIELDS && !rwtest_readerin; i++) {
+		thread_yield();
+	}
+	rwlock_release_read(testrw);
+	P(donesem);
+	P(donesem);
+
+	kprintf("Rwlock test %s\n", synchtest_failed ? "failed" : "done");
+	return 0;
+}
+
+/*
+ * Epochs: readers follow a shared pointer inside epoch sections while
+ * the updater keeps replacing the object, waiting in epoch_synchronize
+ * before poisoning and freeing the old one. A reader that finds the
+ * poison was let in on an object it could still see.
+ */
+struct epochobj {
+	volatile unsigned long eo_value;
+};
+
+static struct epochobj *volatile epochtest_obj;
+static volatile bool epochtest_stop;
+
+static
+void
+epochreaderthread(void *junk, unsigned long num)
+{
+	struct epochobj *eo;
+	volatile int j;
+
+	(void)junk;
+
+	while (!epochtest_stop) {
+		epoch_enter();
+		eo = epochtest_obj;
+		for (j=0; j<100; j++) {
+			if (eo->eo_value != EPOCH_MAGIC) {
+				testfail(num, "reader saw a freed object");
+				break;
+			}
+		}
+		epoch_exit();
+		thread_yield();
+	}
+
+	V(donesem);
+}
+
+int
+epochtest(int nargs, char **args)
+{
+	struct epochobj *old, *new;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	synchtest_failed = false;
+	kprintf("Starting epoch test...\n");
+
+	epochtest_obj = kmalloc(sizeof(struct epochobj));
+	if (epochtest_obj == NULL) {
+		panic("epochtest: Out of memory\n");
+	}
+	epochtest_obj->eo_value = EPOCH_MAGIC;
+	epochtest_stop = false;
+
+	for (i=0; i<NRWREADERS; i++) {
+		synchfork("epochtest", epochreaderthread, i);
+	}
+
+	for (i=0; i<NEPOCHLOOPS; i++) {
+		new = kmalloc(sizeof(struct epochobj));
+		if (new == NULL) {
+			panic("epochtest: Out of memory\n");
+		}
+		new->eo_value = EPOCH_MAGIC;
+		old = epochtest_obj;
+		epochtest_obj = new;
+
+		epoch_synchronize();
+		old->eo_value = EPOCH_POISON;
+		kfree(old);
+		thread_yield();
+	}
+
+	epochtest_stop = true;
+	for (i=0; i<NRWREADERS; i++) {
+		P(donesem);
+	}
+	kfree(epochtest_obj);
+	epochtest_obj = NULL;
+
+	kprintf("Epoch test %s\n", synchtest_failed ? "failed" : "done");
+	return 0;
+}
+#endif /* OPT_A3 */
@@ -34,6 +34,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include "opt-A3.h"
 
 /*
  * Time handling.
@@ -50,8 +51,12 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
+#if OPT_A3
+#define SCHEDULE_HARDCLOCKS	50	/* Age waiting threads every 50. */
+#else
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#endif /* OPT_A3 */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -96,10 +101,15 @@ hardclock(void)
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
+#if OPT_A3
+	/* no periodic migration: idle cpus steal work (thread_switch) */
+	thread_tick();
+#else
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
 	thread_yield();
+#endif /* OPT_A3 */
 }
 
 /*
@@ -36,12 +36,219 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include "opt-A3.h"
 
 /*
  * Spinlocks.
  */
 
 
+#if OPT_A3
+/*
+ * Locks that have ever had to wait, for spinlock_printstats. The list
+ * has a lock of its own that doesn't go through spinlock_acquire,
+ * which would otherwise come back here.
+ */
+static struct spinlock hotlist_lock = SPINLOCK_INITIALIZER;
+static struct spinlock *hotlist;
+
+#define SPINLOCK_NHOT 10	/* how many spinlock_printstats shows */
+
+/* Take and drop a ticket with no checks or statistics. */
+static
+spinlock_data_t
+ticket_take(struct spinlock *lk, uint64_t *spins)
+{
+	spinlock_data_t ticket;
+
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
+	while (spinlock_data_get(&lk->lk_serving) != ticket) {
+		(*spins)++;
+	}
+	return ticket;
+}
+
+static
+void
+ticket_drop(struct spinlock *lk)
+{
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
+}
+
+/* Put LK on the contended list; interrupts off. */
+static
+void
+hotlist_add(struct spinlock *lk)
+{
+	uint64_t spins = 0;
+
+	ticket_take(&hotlist_lock, &spins);
+	if (lk->lk_hotprevp == NULL) {
+		lk->lk_hotnext = hotlist;
+		if (hotlist != NULL) {
+			hotlist->lk_hotprevp = &lk->lk_hotnext;
+		}
+		lk->lk_hotprevp = &hotlist;
+		hotlist = lk;
+	}
+	ticket_drop(&hotlist_lock);
+}
+
+/*
+ * Initialize spinlock.
+ */
+void
+spinlock_init(struct spinlock *lk)
+{
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
+	lk->lk_holder = NULL;
+	lk->lk_acquires = 0;
+	lk->lk_contended = 0;
+	lk->lk_spins = 0;
+	lk->lk_firstpc = 0;
+	lk->lk_hotnext = NULL;
+	lk->lk_hotprevp = NULL;
+}
+
+/*
+ * Clean up spinlock.
+ */
+void
+spinlock_cleanup(struct spinlock *lk)
+{
+	uint64_t spins = 0;
+	int spl;
+
+	KASSERT(lk->lk_holder == NULL);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
+
+	if (lk->lk_hotprevp != NULL) {
+		spl = splhigh();
+		ticket_take(&hotlist_lock, &spins);
+		*lk->lk_hotprevp = lk->lk_hotnext;
+		if (lk->lk_hotnext != NULL) {
+			lk->lk_hotnext->lk_hotprevp = lk->lk_hotprevp;
+		}
+		lk->lk_hotprevp = NULL;
+		ticket_drop(&hotlist_lock);
+		splx(spl);
+	}
+}
+
+/*
+ * Get the lock.
+ *
+ * First disable interrupts (otherwise, if we get a timer interrupt we
+ * might come back to this lock and deadlock), then take a ticket and
+ * wait for it to come up.
+ */
+void
+spinlock_acquire(struct spinlock *lk)
+{
+	struct cpu *mycpu;
+	uint64_t spins;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (lk->lk_holder == mycpu) {
+			panic("Deadlock on spinlock %p\n", lk);
+		}
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	spins = 0;
+	ticket_take(lk, &spins);
+
+	lk->lk_holder = mycpu;
+	lk->lk_acquires++;
+	if (spins > 0) {
+		lk->lk_contended++;
+		lk->lk_spins += spins;
+		if (lk->lk_hotprevp == NULL) {
+			lk->lk_firstpc = (vaddr_t)__builtin_return_address(0);
+			hotlist_add(lk);
+		}
+	}
+}
+
+/*
+ * Release the lock.
+ */
+void
+spinlock_release(struct spinlock *lk)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(lk->lk_holder == curcpu->c_self);
+	}
+
+	lk->lk_holder = NULL;
+	ticket_drop(lk);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+/*
+ * Print the SPINLOCK_NHOT locks that have spent longest waiting. A
+ * lock is shown by its address and the caller that first had to wait
+ * for it, which os161-addr2line turns into a line of code.
+ */
+void
+spinlock_printstats(void)
+{
+	struct spinlock *hot[SPINLOCK_NHOT];
+	struct spinlock copy[SPINLOCK_NHOT];
+	struct spinlock *lk;
+	uint64_t spins = 0;
+	unsigned nhot, i, j;
+	int spl;
+
+	nhot = 0;
+	spl = splhigh();
+	ticket_take(&hotlist_lock, &spins);
+	for (lk = hotlist; lk != NULL; lk = lk->lk_hotnext) {
+		/* insert into hot[], kept sorted by most spins first */
+		for (i = nhot; i > 0 && hot[i-1]->lk_spins < lk->lk_spins; i--) {
+			if (i < SPINLOCK_NHOT) {
+				hot[i] = hot[i-1];
+			}
+		}
+		if (i < SPINLOCK_NHOT) {
+			hot[i] = lk;
+			if (nhot < SPINLOCK_NHOT) {
+				nhot++;
+			}
+		}
+	}
+
+	/* print from copies, so the list lock isn't held over kprintf */
+	for (j = 0; j < nhot; j++) {
+		copy[j] = *hot[j];
+	}
+	ticket_drop(&hotlist_lock);
+	splx(spl);
+
+	kprintf("Most contended spinlocks:\n");
+	kprintf("%-10s  %10s  %10s  %14s  %s\n",
+		"lock", "acquires", "contended", "spins", "first waiter");
+	for (j = 0; j < nhot; j++) {
+		kprintf("%p  %10u  %10u  %14llu  0x%08lx\n", hot[j],
+			copy[j].lk_acquires, copy[j].lk_contended,
+			(unsigned long long)copy[j].lk_spins,
+			(unsigned long)copy[j].lk_firstpc);
+	}
+	if (nhot == 0) {
+		kprintf("(none has had to wait)\n");
+	}
+}
+#else
 /*
  * Initialize spinlock.
  */
@@ -126,6 +333,8 @@ spinlock_release(struct spinlock *lk)
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
+#endif /* OPT_A3 */
+
 /*
  * Check if the current cpu holds the lock.
  */ 
@@ -39,6 +39,10 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#if OPT_A3
+#include <spl.h>
+#include <cpu.h>
+#endif /* OPT_A3 */
 
 ////////////////////////////////////////////////////////////
 //
@@ -175,6 +179,12 @@ lock_create(const char *name)
 	
 	lock->lk_holder = NULL;
 	//lock->lk_count = 0;	
+#if OPT_A3
+	lock->lk_acquires = 0;
+	lock->lk_contended = 0;
+	lock->lk_spins = 0;
+	lock->lk_sleeps = 0;
+#endif /* OPT_A3 */
 
         return lock;
 }
@@ -193,6 +203,85 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+#if OPT_A3
+/*
+ * True if HOLDER still holds LOCK and is running on another cpu. This
+ * is called without lk_lock, so the holder may let go, exit, and have
+ * its thread structure handed to a new thread while we look. So t_cpu
+ * is read only once the holder has been seen holding the lock, which
+ * must still be so afterwards, and even then it is only followed if it
+ * is one of the cpus, which never go away.
+ */
+static
+bool
+lock_holder_running(struct lock *lock, struct thread *holder)
+{
+	struct cpu *c;
+	unsigned i, n;
+
+	if (lock->lk_holder != holder) {
+		return false;
+	}
+	c = *(struct cpu *volatile *)&holder->t_cpu;
+	if (lock->lk_holder != holder || c == NULL ||
+	    c == curcpu->c_self) {
+		return false;
+	}
+
+	n = cpu_count();
+	for (i = 0; i < n; i++) {
+		if (cpu_get(i) == c) {
+			return *(struct thread *volatile *)&c->c_curthread
+				== holder;
+		}
+	}
+	return false;
+}
+
+/* Because lock is basically just a binary semaphore whose initial counter is 1
+ * binary semaphore means that its counter is either 0 or 1
+ * for lock, it means that it has holder or not (notNULL or NULL)
+ * lock_acquire is like P, while lock_release is like V;
+ * except that while the holder is running, we spin instead of sleeping
+ */
+void
+lock_acquire(struct lock *lock)
+{
+	struct thread *holder;
+
+        KASSERT(lock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&lock->lk_lock);
+	lock->lk_acquires++;
+	if (lock->lk_holder != NULL) {
+		lock->lk_contended++;
+	}
+
+        while (lock->lk_holder != NULL) {
+		holder = (struct thread *)lock->lk_holder;
+		if (lock_holder_running(lock, holder)) {
+			// lk_lock is only for claiming the lock or sleeping
+			lock->lk_spins++;
+			spinlock_release(&lock->lk_lock);
+			while (lock_holder_running(lock, holder)) {
+				/* spin */
+			}
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		lock->lk_sleeps++;
+		wchan_lock(lock->lk_wchan);
+		spinlock_release(&lock->lk_lock);
+                wchan_sleep(lock->lk_wchan);
+
+		spinlock_acquire(&lock->lk_lock);
+        }
+        KASSERT(lock->lk_holder == NULL);
+        lock->lk_holder = curthread;
+	spinlock_release(&lock->lk_lock);
+}
+#else
 /* Because lock is basically just a binary semaphore whose initial counter is 1
  * binary semaphore means that its counter is either 0 or 1
  * for lock, it means that it has holder or not (notNULL or NULL)
@@ -220,6 +309,7 @@ lock_acquire(struct lock *lock)
 	spinlock_release(&lock->lk_lock);
         //(void)lock;  // suppress warning until code gets written
 }
+#endif /* OPT_A3 */
 
 void
 lock_release(struct lock *lock)
@@ -337,3 +427,221 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	//(void)cv;    // suppress warning until code gets written
 	//(void)lock;  // suppress warning until code gets written
 }
+
+#if OPT_A3
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rwlock_rwchan = wchan_create(rw->rwlock_name);
+	if (rw->rwlock_rwchan == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rwlock_wwchan = wchan_create(rw->rwlock_name);
+	if (rw->rwlock_wwchan == NULL) {
+		wchan_destroy(rw->rwlock_rwchan);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rwlock_lock);
+	rw->rwlock_readers = 0;
+	rw->rwlock_wwaiting = 0;
+	rw->rwlock_writer = NULL;
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rwlock_readers == 0);
+	KASSERT(rw->rwlock_writer == NULL);
+	KASSERT(rw->rwlock_wwaiting == 0);
+
+	spinlock_cleanup(&rw->rwlock_lock);
+	wchan_destroy(rw->rwlock_wwchan);
+	wchan_destroy(rw->rwlock_rwchan);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+/*
+ * Readers wait while a writer holds the lock, and also while one is
+ * waiting for it; that is what keeps writers from starving.
+ */
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_writer != curthread);
+	while (rw->rwlock_writer != NULL || rw->rwlock_wwaiting > 0) {
+		wchan_lock(rw->rwlock_rwchan);
+		spinlock_release(&rw->rwlock_lock);
+		wchan_sleep(rw->rwlock_rwchan);
+
+		spinlock_acquire(&rw->rwlock_lock);
+	}
+	rw->rwlock_readers++;
+	spinlock_release(&rw->rwlock_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_readers > 0);
+	rw->rwlock_readers--;
+	if (rw->rwlock_readers == 0 && rw->rwlock_wwaiting > 0) {
+		wchan_wakeone(rw->rwlock_wwchan);
+	}
+	spinlock_release(&rw->rwlock_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rwlock_lock);
+	KASSERT(rw->rwlock_writer != curthread);
+	rw->rwlock_wwaiting++;
+	while (rw->rwlock_writer != NULL || rw->rwlock_readers > 0) {
+		wchan_lock(rw->rwlock_wwchan);
+		spinlock_release(&rw->rwlock_lock);
+		wchan_sleep(rw->rwlock_wwchan);
+
+		spinlock_acquire(&rw->rwlock_lock);
+	}
+	rw->rwlock_wwaiting--;
+	rw->rwlock_writer = curthread;
+	spinlock_release(&rw->rwlock_lock);
+}
+
+/*
+ * Hand the lock to the next writer if there is one; only when no
+ * writer is left do the readers that piled up behind them get to go.
+ */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rwlock_do_i_hold_write(rw));
+
+	spinlock_acquire(&rw->rwlock_lock);
+	rw->rwlock_writer = NULL;
+	if (rw->rwlock_wwaiting > 0) {
+		wchan_wakeone(rw->rwlock_wwchan);
+	} else {
+		wchan_wakeall(rw->rwlock_rwchan);
+	}
+	spinlock_release(&rw->rwlock_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	return rw->rwlock_writer == curthread;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Epochs.
+
+/*
+ * The current epoch. Never 0, which in a cpu's c_epoch means it is
+ * outside any section; the lock is only for bumping it.
+ */
+static volatile unsigned epoch_current = 1;
+static struct spinlock epoch_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Sections run at splhigh, so the thread can't be switched out or
+ * moved to another cpu in the middle of one, and an interrupt handler
+ * can't start a section of its own under it.
+ */
+void
+epoch_enter(void)
+{
+	int s;
+
+	s = splhigh();
+	if (curcpu->c_epoch_nest++ == 0) {
+		curcpu->c_epoch_spl = s;
+		curcpu->c_epoch = epoch_current;
+	}
+}
+
+void
+epoch_exit(void)
+{
+	KASSERT(curcpu->c_epoch_nest > 0);
+
+	if (--curcpu->c_epoch_nest == 0) {
+		curcpu->c_epoch = 0;
+		splx(curcpu->c_epoch_spl);
+	}
+}
+
+/*
+ * Start a new epoch, then wait for every cpu to be out of sections
+ * that started in an older one. A cpu that enters one after the bump
+ * can't see anything retired before we were called.
+ */
+void
+epoch_synchronize(void)
+{
+	struct cpu *c;
+	unsigned target, e, i;
+
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(curcpu->c_epoch_nest == 0);
+
+	spinlock_acquire(&epoch_lock);
+	if (++epoch_current == 0) {
+		epoch_current = 1;
+	}
+	target = epoch_current;
+	spinlock_release(&epoch_lock);
+
+	for (i = 0; i < cpu_count(); i++) {
+		c = cpu_get(i);
+		for (;;) {
+			e = c->c_epoch;
+			if (e == 0 || (int)(e - target) >= 0) {
+				break;
+			}
+			// sections are short; let somebody else run
+			thread_yield();
+		}
+	}
+}
+#endif /* OPT_A3 */
@@ -52,6 +52,10 @@
 #include <vnode.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A3.h"
+#if OPT_A3
+#include <kmem.h>
+#endif /* OPT_A3 */
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
@@ -71,6 +75,103 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+#if OPT_A3
+/* Object caches for threads and wait channels. */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread));
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan));
+#endif /* OPT_A3 */
+
+#if OPT_A3
+/*
+ * Multi-level feedback queue. Each cpu has a run queue per priority
+ * level and runs the head of the highest non-empty one. A thread gets
+ * a quantum of hardclocks that doubles with each level down; using it
+ * all up moves it down a level, and blocking on a wait channel moves it
+ * up one, so I/O-bound threads rise above CPU-bound ones. schedule()
+ * ages waiting threads up a level now and then so that nothing starves.
+ */
+#define THREAD_QUANTUM(prio)	(2U << (prio))
+
+/*
+ * Load balancing is by work stealing: a cpu with nothing to run takes
+ * a thread off the busiest other cpu's run queue (see thread_steal).
+ * A thread that hasn't run for this many of its cpu's hardclocks has
+ * lost its cache there, so it is the cheapest one to move.
+ */
+#define THREAD_COLD_HARDCLOCKS	4
+
+/* Run queue operations; the cpu's run queue lock must be held. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_priority < CPU_NPRIO);
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount++;
+}
+
+/* the next thread to run: first from the highest level */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+
+	for (unsigned i = 0; i < CPU_NPRIO; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The thread to give away to another cpu: the first one, from the
+ * lowest level up, whose cache affinity has gone cold; failing that,
+ * the longest-waiting one on the lowest level. Never the cpu's
+ * curthread, which can be on its run queue while the cpu is still
+ * switching away from it, on its stack.
+ */
+static
+struct thread *
+runqueue_steal(struct cpu *c)
+{
+	struct thread *t, *pick;
+	unsigned now;
+
+	now = c->c_hardclocks;
+	pick = NULL;
+	for (unsigned i = CPU_NPRIO; i-- > 0; ) {
+		THREADLIST_FORALL(t, c->c_runqueue[i]) {
+			if (t == c->c_curthread) {
+				continue;
+			}
+			if (now - t->t_lastran >= THREAD_COLD_HARDCLOCKS) {
+				pick = t;
+				goto found;
+			}
+			if (pick == NULL) {
+				pick = t;
+			}
+		}
+	}
+	if (pick == NULL) {
+		return NULL;
+	}
+ found:
+	threadlist_remove(&c->c_runqueue[pick->t_priority], pick);
+	c->c_runcount--;
+	return pick;
+}
+
+static bool thread_steal(void);
+static void thread_kick_idle(struct cpu *busycpu);
+#endif /* OPT_A3 */
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -122,14 +223,22 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
+#if OPT_A3
+	thread = kmem_cache_alloc(&thread_cache);
+#else
 	thread = kmalloc(sizeof(*thread));
+#endif /* OPT_A3 */
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
+#if OPT_A3
+		kmem_cache_free(&thread_cache, thread);
+#else
 		kfree(thread);
+#endif /* OPT_A3 */
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -142,6 +251,11 @@ thread_create(const char *name)
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+#if OPT_A3
+	thread->t_priority = 0;
+	thread->t_quantum = THREAD_QUANTUM(0);
+	thread->t_lastran = 0;
+#endif /* OPT_A3 */
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -181,13 +295,31 @@ cpu_create(unsigned hardware_number)
 	c->c_hardclocks = 0;
 
 	c->c_isidle = false;
+#if OPT_A3
+	for (unsigned i = 0; i < CPU_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+#else
 	threadlist_init(&c->c_runqueue);
+#endif /* OPT_A3 */
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
 
+#if OPT_A3
+	c->c_pagecache_num = 0;
+	spinlock_init(&c->c_pagecache_lock);
+	c->c_asid = 0;
+	c->c_asidgen = 0;
+	c->c_tlb_next = 0;
+	c->c_epoch = 0;
+	c->c_epoch_nest = 0;
+	c->c_epoch_spl = 0;
+#endif /* OPT_A3 */
+
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
@@ -226,6 +358,20 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+#if OPT_A3
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned num)
+{
+	return cpuarray_get(&allcpus, num);
+}
+#endif /* OPT_A3 */
+
 /*
  * Destroy a thread.
  *
@@ -258,7 +404,11 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
+#if OPT_A3
+	kmem_cache_free(&thread_cache, thread);
+#else
 	kfree(thread);
+#endif /* OPT_A3 */
 }
 
 /*
@@ -302,9 +452,18 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
+#if OPT_A3
+	for (unsigned i = 0; i < CPU_NPRIO; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
+#else
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = NULL;
 	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+#endif /* OPT_A3 */
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -449,7 +608,11 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 
 	isidle = targetcpu->c_isidle;
+#if OPT_A3
+	runqueue_add(targetcpu, target);
+#else
 	threadlist_addtail(&targetcpu->c_runqueue, target);
+#endif /* OPT_A3 */
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -457,6 +620,12 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+#if OPT_A3
+	else if (targetcpu->c_runcount > 1) {
+		/* more than it can get to soon; have someone steal */
+		thread_kick_idle(targetcpu);
+	}
+#endif /* OPT_A3 */
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -573,12 +742,21 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
+#if OPT_A3
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
+#else
 	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+#endif /* OPT_A3 */
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+#if OPT_A3
+	/* for runqueue_steal: how long since it was on this cpu */
+	cur->t_lastran = curcpu->c_hardclocks;
+#endif /* OPT_A3 */
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -603,6 +781,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		 */
 		threadlist_addtail(&wc->wc_threads, cur);
 		wchan_unlock(wc);
+#if OPT_A3
+		/* it gave up the cpu before its quantum ran out: move it up */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+		}
+		cur->t_quantum = THREAD_QUANTUM(cur->t_priority);
+#endif /* OPT_A3 */
 		break;
 	    case S_ZOMBIE:
 		cur->t_wchan_name = "ZOMBIE";
@@ -631,10 +816,21 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
+#if OPT_A3
+		next = runqueue_remhead(curcpu->c_self);
+#else
 		next = threadlist_remhead(&curcpu->c_runqueue);
+#endif /* OPT_A3 */
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
+#if OPT_A3
+			/* only idle if there is nothing to steal */
+			if (!thread_steal()) {
+				cpu_idle();
+			}
+#else
 			cpu_idle();
+#endif /* OPT_A3 */
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -825,6 +1021,66 @@ thread_yield(void)
  * the current CPU's run queue by job priority.
  */
 
+#if OPT_A3
+/*
+ * Aging: move every waiting thread up a level (with a fresh quantum for
+ * it), so CPU-bound threads get to run even while I/O-bound ones keep
+ * the top levels busy.
+ */
+void
+schedule(void)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *t;
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	for (unsigned i = 1; i < CPU_NPRIO; i++) {
+		while ((t = threadlist_remhead(&c->c_runqueue[i])) != NULL) {
+			t->t_priority = i - 1;
+			t->t_quantum = THREAD_QUANTUM(i - 1);
+			threadlist_addtail(&c->c_runqueue[i - 1], t);
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool preempt = false;
+
+	/* the idle loop isn't charged for anything */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	KASSERT(cur->t_quantum > 0);
+	if (--cur->t_quantum == 0) {
+		/* used its whole quantum: down a level */
+		if (cur->t_priority < CPU_NPRIO - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum = THREAD_QUANTUM(cur->t_priority);
+		thread_yield();
+		return;
+	}
+
+	/* otherwise only make way for someone more important */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (unsigned i = 0; i < cur->t_priority; i++) {
+		if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+			preempt = true;
+			break;
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+#else
 void
 schedule(void)
 {
@@ -833,7 +1089,93 @@ schedule(void)
 	 * round-robin fashion.
 	 */
 }
+#endif /* OPT_A3 */
 
+#if OPT_A3
+/*
+ * Thread migration, by work stealing.
+ *
+ * Rather than busy cpus periodically pushing threads away, a cpu that
+ * runs out of threads pulls one from whichever other cpu has the most
+ * waiting. The victim is chosen from the run counts without taking
+ * any other cpu's lock; they are only a hint, and if the victim turns
+ * out to have nothing to give by the time we lock it we just try again
+ * after the next interrupt. Of its threads we take one whose cache
+ * affinity there has gone cold, if there is one (see runqueue_steal).
+ *
+ * Called from the idle loop in thread_switch, with interrupts off and
+ * without our own run queue lock, so that two cpus stealing from each
+ * other can never hold each other's locks. Returns true if a thread was
+ * put on our run queue.
+ */
+static
+bool
+thread_steal(void)
+{
+	unsigned i, numcpus, load, maxload;
+	struct cpu *c, *victim;
+	struct thread *t;
+
+	victim = NULL;
+	maxload = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		load = c->c_runcount;
+		if (load > maxload) {
+			maxload = load;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = runqueue_steal(victim);
+	spinlock_release(&victim->c_runqueue_lock);
+	if (t == NULL) {
+		return false;
+	}
+
+	/* t is on no list now, so nobody else can get at it */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	t->t_cpu = curcpu->c_self;
+	runqueue_add(curcpu->c_self, t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return true;
+}
+
+/*
+ * Wake an idle cpu, if there is one, so it comes and steals from
+ * BUSYCPU, which has threads waiting behind the one it is running.
+ * Like thread_steal this reads other cpus' state without their locks;
+ * at worst a cpu gets woken for nothing, or sleeps until its next
+ * timer interrupt.
+ */
+static
+void
+thread_kick_idle(struct cpu *busycpu)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busycpu && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+#else
 /*
  * Thread migration.
  *
@@ -955,6 +1297,7 @@ thread_consider_migration(void)
 	KASSERT(threadlist_isempty(&victims));
 	threadlist_cleanup(&victims);
 }
+#endif /* OPT_A3 */
 
 ////////////////////////////////////////////////////////////
 
@@ -975,7 +1318,11 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
+#if OPT_A3
+	wc = kmem_cache_alloc(&wchan_cache);
+#else
 	wc = kmalloc(sizeof(*wc));
+#endif /* OPT_A3 */
 	if (wc == NULL) {
 		return NULL;
 	}
@@ -994,7 +1341,11 @@ wchan_destroy(struct wchan *wc)
 {
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
+#if OPT_A3
+	kmem_cache_free(&wchan_cache, wc);
+#else
 	kfree(wc);
+#endif /* OPT_A3 */
 }
 
 /*
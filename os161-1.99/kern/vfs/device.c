@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include "opt-A3.h"
 
 /*
  * Called for each open().
@@ -244,6 +245,19 @@ null_fsync(struct vnode *v)
  * For mmap. If you want this to do anything, you have to write it
  * yourself. Some devices may not make sense to map. Others do.
  */
+#if OPT_A3
+/*
+ * None of ours do: mapped pages are paged with VOP_READ and VOP_WRITE
+ * at arbitrary file sizes, which raw disks and the console don't take.
+ */
+static
+int
+dev_mmap(struct vnode *v)
+{
+	(void)v;
+	return ENODEV;
+}
+#else
 static
 int
 dev_mmap(struct vnode *v  /* add stuff as needed */)
@@ -251,6 +265,7 @@ dev_mmap(struct vnode *v  /* add stuff as needed */)
 	(void)v;
 	return EUNIMP;
 }
+#endif /* OPT_A3 */
 
 /*
  * For ftruncate(). 
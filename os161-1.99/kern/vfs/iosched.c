@@ -0,0 +1,319 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <uio.h>
+#include <device.h>
+#include <iosched.h>
+
+/*
+ * One queue per attached device. The queue is kept sorted by block,
+ * so C-SCAN takes the first request at or past the head position;
+ * FIFO and the deadline check look for the oldest request instead.
+ */
+struct iosched {
+	struct device *q_dev;
+	struct lock *q_lock;
+	struct cv *q_work;		// worker waits here for requests
+	struct cv *q_done;		// submitters wait here for theirs
+	struct ioreq *q_head;		// pending, sorted by block
+	uint32_t q_pos;			// block after the last one issued
+	uint32_t q_arrivals;		// requests queued so far
+	uint32_t q_dispatched;		// requests issued so far
+	bool q_exiting;			// worker should exit once idle
+	bool q_exited;			// ...and has
+	struct iosched *q_next;
+};
+
+static struct iosched *iosched_list;
+static struct spinlock iosched_listlock = SPINLOCK_INITIALIZER;
+static volatile int iosched_policy = IOSCHED_DEADLINE;
+
+static const char *const iosched_names[IOSCHED_NPOLICIES] = {
+	"fifo", "cscan", "deadline",
+};
+
+static
+struct iosched *
+iosched_find(struct device *dev)
+{
+	struct iosched *q;
+
+	spinlock_acquire(&iosched_listlock);
+	for (q = iosched_list; q != NULL; q = q->q_next) {
+		if (q->q_dev == dev) {
+			break;
+		}
+	}
+	spinlock_release(&iosched_listlock);
+	return q;
+}
+
+// is A older than B, allowing for the counters wrapping
+static
+bool
+iosched_before(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) < 0;
+}
+
+// link pointing at the request to issue next; queue not empty
+static
+struct ioreq **
+iosched_pick(struct iosched *q)
+{
+	struct ioreq **rp, **best = NULL;
+	int policy = iosched_policy;
+
+	if (policy == IOSCHED_FIFO) {
+		for (rp = &q->q_head; *rp != NULL; rp = &(*rp)->ior_next) {
+			if (best == NULL || iosched_before((*rp)->ior_arrival,
+							   (*best)->ior_arrival)) {
+				best = rp;
+			}
+		}
+		return best;
+	}
+
+	if (policy == IOSCHED_DEADLINE) {
+		for (rp = &q->q_head; *rp != NULL; rp = &(*rp)->ior_next) {
+			struct ioreq *r = *rp;
+			uint32_t expire = r->ior_uio->uio_rw == UIO_READ ?
+				IOSCHED_READ_EXPIRE : IOSCHED_WRITE_EXPIRE;
+
+			if (q->q_dispatched - r->ior_queued < expire) {
+				continue;
+			}
+			if (best == NULL || iosched_before(r->ior_arrival,
+							   (*best)->ior_arrival)) {
+				best = rp;
+			}
+		}
+		if (best != NULL) {
+			return best;
+		}
+	}
+
+	// C-SCAN: sweep upwards, then start over from the lowest block
+	for (rp = &q->q_head; *rp != NULL; rp = &(*rp)->ior_next) {
+		if ((*rp)->ior_block >= q->q_pos) {
+			return rp;
+		}
+	}
+	return &q->q_head;
+}
+
+static
+void
+iosched_worker(void *data1, unsigned long data2)
+{
+	struct iosched *q = data1;
+	struct ioreq **rp, *r;
+	int result;
+
+	(void)data2;
+
+	lock_acquire(q->q_lock);
+	while (1) {
+		while (q->q_head == NULL && !q->q_exiting) {
+			cv_wait(q->q_work, q->q_lock);
+		}
+		if (q->q_head == NULL) {
+			// iosched_detach frees q once it sees this
+			q->q_exited = true;
+			cv_broadcast(q->q_done, q->q_lock);
+			lock_release(q->q_lock);
+			return;
+		}
+
+		rp = iosched_pick(q);
+		r = *rp;
+		*rp = r->ior_next;
+		q->q_pos = r->ior_block +
+			r->ior_uio->uio_resid / q->q_dev->d_blocksize;
+		q->q_dispatched++;
+
+		lock_release(q->q_lock);
+		result = q->q_dev->d_io(q->q_dev, r->ior_uio);
+		lock_acquire(q->q_lock);
+
+		r->ior_result = result;
+		r->ior_done = true;
+		cv_broadcast(q->q_done, q->q_lock);
+	}
+}
+
+/*
+ * Give DEV a queue and a worker thread, unless it has them already.
+ */
+int
+iosched_attach(struct device *dev)
+{
+	struct iosched *q;
+	int result;
+
+	if (iosched_find(dev) != NULL) {
+		return 0;
+	}
+
+	q = kmalloc(sizeof(struct iosched));
+	if (q == NULL) {
+		return ENOMEM;
+	}
+	q->q_lock = lock_create("iosched");
+	q->q_work = cv_create("iosched-work");
+	q->q_done = cv_create("iosched-done");
+	if (q->q_lock == NULL || q->q_work == NULL || q->q_done == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+	q->q_dev = dev;
+	q->q_head = NULL;
+	q->q_pos = 0;
+	q->q_arrivals = 0;
+	q->q_dispatched = 0;
+	q->q_exiting = false;
+	q->q_exited = false;
+
+	result = thread_fork("iosched", NULL, iosched_worker, q, 0);
+	if (result) {
+		goto fail;
+	}
+
+	spinlock_acquire(&iosched_listlock);
+	q->q_next = iosched_list;
+	iosched_list = q;
+	spinlock_release(&iosched_listlock);
+	return 0;
+
+ fail:
+	if (q->q_done != NULL) {
+		cv_destroy(q->q_done);
+	}
+	if (q->q_work != NULL) {
+		cv_destroy(q->q_work);
+	}
+	if (q->q_lock != NULL) {
+		lock_destroy(q->q_lock);
+	}
+	kfree(q);
+	return result;
+}
+
+/*
+ * Stop DEV's worker, once it has issued everything queued, and free
+ * DEV's queue. Nothing may be submitted for DEV meanwhile.
+ */
+void
+iosched_detach(struct device *dev)
+{
+	struct iosched *q, **qp;
+
+	spinlock_acquire(&iosched_listlock);
+	for (qp = &iosched_list; *qp != NULL; qp = &(*qp)->q_next) {
+		if ((*qp)->q_dev == dev) {
+			break;
+		}
+	}
+	q = *qp;
+	if (q != NULL) {
+		*qp = q->q_next;
+	}
+	spinlock_release(&iosched_listlock);
+
+	if (q == NULL) {
+		return;
+	}
+
+	lock_acquire(q->q_lock);
+	q->q_exiting = true;
+	cv_signal(q->q_work, q->q_lock);
+	while (!q->q_exited) {
+		cv_wait(q->q_done, q->q_lock);
+	}
+	lock_release(q->q_lock);
+
+	cv_destroy(q->q_done);
+	cv_destroy(q->q_work);
+	lock_destroy(q->q_lock);
+	kfree(q);
+}
+
+/*
+ * Queue R to move UIO through DEV, without waiting for it.
+ */
+void
+iosched_submit(struct device *dev, struct ioreq *r, struct uio *uio)
+{
+	struct iosched *q = iosched_find(dev);
+	struct ioreq **rp;
+
+	KASSERT(q != NULL);
+	KASSERT(uio->uio_segflg == UIO_SYSSPACE);
+	KASSERT(uio->uio_offset % dev->d_blocksize == 0);
+
+	r->ior_uio = uio;
+	r->ior_block = uio->uio_offset / dev->d_blocksize;
+	r->ior_done = false;
+	r->ior_result = 0;
+
+	lock_acquire(q->q_lock);
+	r->ior_arrival = q->q_arrivals++;
+	r->ior_queued = q->q_dispatched;
+
+	// equal blocks stay in arrival order
+	for (rp = &q->q_head; *rp != NULL; rp = &(*rp)->ior_next) {
+		if ((*rp)->ior_block > r->ior_block) {
+			break;
+		}
+	}
+	r->ior_next = *rp;
+	*rp = r;
+
+	cv_signal(q->q_work, q->q_lock);
+	lock_release(q->q_lock);
+}
+
+int
+iosched_wait(struct device *dev, struct ioreq *r)
+{
+	struct iosched *q = iosched_find(dev);
+
+	KASSERT(q != NULL);
+
+	lock_acquire(q->q_lock);
+	while (!r->ior_done) {
+		cv_wait(q->q_done, q->q_lock);
+	}
+	lock_release(q->q_lock);
+
+	return r->ior_result;
+}
+
+int
+iosched_setpolicy(const char *name)
+{
+	int i;
+
+	for (i = 0; i < IOSCHED_NPOLICIES; i++) {
+		if (!strcmp(name, iosched_names[i])) {
+			iosched_policy = i;
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+const char *
+iosched_getpolicy(void)
+{
+	return iosched_names[iosched_policy];
+}
+
+#endif /* OPT_A3 */
@@ -0,0 +1,319 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <limits.h>
+#include <lib.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <namecache.h>
+
+/*
+ * Name cache; see namecache.h.
+ *
+ * Entries hang off a hash table by (directory, name) and are on one
+ * LRU list, most recently used at the head. Names longer than
+ * NAME_MAX aren't worth keeping and aren't cached.
+ */
+struct ncentry {
+	struct ncentry *nc_hashnext;
+	struct ncentry *nc_lrunext;	// toward the tail (older)
+	struct ncentry *nc_lruprev;
+	struct vnode *nc_dir;
+	struct vnode *nc_vn;		// NULL for a negative entry
+	uint32_t nc_hash;
+	bool nc_path;			// name has a '/' in it
+	char nc_name[];
+};
+
+static struct ncentry *nc_buckets[NC_NBUCKETS];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+static unsigned nc_count;
+static unsigned nc_npaths;		// entries with nc_path set
+
+/* statistics */
+static unsigned nc_hits;		// found a vnode
+static unsigned nc_neghits;		// found a negative entry
+static unsigned nc_misses;		// had to ask the filesystem
+static unsigned nc_evictions;		// pushed out by newer entries
+static unsigned nc_purged;		// dropped because something changed
+
+/* FNV-1a over the directory's address, then the name */
+static
+uint32_t
+nc_hashof(struct vnode *dir, const char *name)
+{
+	uint32_t h = 2166136261U;
+	uintptr_t d = (uintptr_t)dir;
+	unsigned i;
+
+	for (i=0; i<sizeof(d); i++) {
+		h = (h ^ (d & 0xff)) * 16777619U;
+		d >>= 8;
+	}
+	while (*name) {
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	}
+	return h;
+}
+
+static
+void
+nc_lru_unlink(struct ncentry *e)
+{
+	if (e->nc_lruprev != NULL) {
+		e->nc_lruprev->nc_lrunext = e->nc_lrunext;
+	} else {
+		nc_lruhead = e->nc_lrunext;
+	}
+	if (e->nc_lrunext != NULL) {
+		e->nc_lrunext->nc_lruprev = e->nc_lruprev;
+	} else {
+		nc_lrutail = e->nc_lruprev;
+	}
+}
+
+static
+void
+nc_lru_push(struct ncentry *e)
+{
+	e->nc_lruprev = NULL;
+	e->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = e;
+	} else {
+		nc_lrutail = e;
+	}
+	nc_lruhead = e;
+}
+
+/*
+ * Take an entry out of the cache, and drop its references.
+ */
+static
+void
+nc_remove(struct ncentry *e)
+{
+	struct ncentry **ep;
+
+	ep = &nc_buckets[e->nc_hash & (NC_NBUCKETS - 1)];
+	while (*ep != e) {
+		KASSERT(*ep != NULL);
+		ep = &(*ep)->nc_hashnext;
+	}
+	*ep = e->nc_hashnext;
+	nc_lru_unlink(e);
+	nc_count--;
+	if (e->nc_path) {
+		nc_npaths--;
+	}
+
+	if (e->nc_vn != NULL) {
+		VOP_DECREF(e->nc_vn);
+	}
+	VOP_DECREF(e->nc_dir);
+	kfree(e);
+}
+
+static
+struct ncentry *
+nc_find(struct vnode *dir, const char *name, uint32_t hash)
+{
+	struct ncentry *e;
+
+	for (e = nc_buckets[hash & (NC_NBUCKETS - 1)]; e != NULL;
+	     e = e->nc_hashnext) {
+		if (e->nc_hash == hash && e->nc_dir == dir &&
+		    !strcmp(e->nc_name, name)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Look NAME up in DIR. Returns false on a miss. On a hit, hands back
+ * the vnode with a new reference, or NULL if the name is known not to
+ * exist.
+ */
+bool
+namecache_lookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct ncentry *e;
+
+	if (dir->vn_fs == NULL || strlen(name) > NAME_MAX) {
+		return false;
+	}
+
+	vfs_biglock_acquire();
+
+	e = nc_find(dir, name, nc_hashof(dir, name));
+	if (e == NULL) {
+		nc_misses++;
+		vfs_biglock_release();
+		return false;
+	}
+
+	// most recently used now
+	nc_lru_unlink(e);
+	nc_lru_push(e);
+
+	if (e->nc_vn != NULL) {
+		nc_hits++;
+		VOP_INCREF(e->nc_vn);
+	} else {
+		nc_neghits++;
+	}
+	*ret = e->nc_vn;
+
+	vfs_biglock_release();
+	return true;
+}
+
+/*
+ * Remember that NAME in DIR is VN, or doesn't exist if VN is NULL.
+ * If there's no memory for it, we just don't remember.
+ */
+void
+namecache_enter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct ncentry *e, *old;
+	uint32_t hash;
+	size_t len;
+
+	len = strlen(name);
+	if (dir->vn_fs == NULL || len > NAME_MAX) {
+		return;
+	}
+
+	e = kmalloc(sizeof(struct ncentry) + len + 1);
+	if (e == NULL) {
+		return;
+	}
+	hash = nc_hashof(dir, name);
+	e->nc_dir = dir;
+	e->nc_vn = vn;
+	e->nc_hash = hash;
+	e->nc_path = strchr(name, '/') != NULL;
+	memcpy(e->nc_name, name, len + 1);
+
+	vfs_biglock_acquire();
+
+	old = nc_find(dir, name, hash);
+	if (old != NULL) {
+		nc_remove(old);
+	}
+	if (nc_count >= NC_MAXENTRIES) {
+		KASSERT(nc_lrutail != NULL);
+		nc_remove(nc_lrutail);
+		nc_evictions++;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	e->nc_hashnext = nc_buckets[hash & (NC_NBUCKETS - 1)];
+	nc_buckets[hash & (NC_NBUCKETS - 1)] = e;
+	nc_lru_push(e);
+	nc_count++;
+	if (e->nc_path) {
+		nc_npaths++;
+	}
+
+	vfs_biglock_release();
+}
+
+/*
+ * NAME in DIR was created (NEGATIVE_ONLY), or removed or renamed.
+ * Drop its own entry, and the cached paths on DIR's filesystem that
+ * may go through it: the negative ones, or all of them.
+ */
+void
+namecache_invalidate(struct vnode *dir, const char *name, bool negative_only)
+{
+	struct ncentry *e, *next;
+
+	if (dir->vn_fs == NULL) {
+		return;
+	}
+
+	vfs_biglock_acquire();
+
+	if (strlen(name) <= NAME_MAX) {
+		e = nc_find(dir, name, nc_hashof(dir, name));
+		if (e != NULL) {
+			nc_remove(e);
+			nc_purged++;
+		}
+	}
+
+	for (e = nc_lruhead; e != NULL && nc_npaths > 0; e = next) {
+		next = e->nc_lrunext;
+		if (!e->nc_path || e->nc_dir->vn_fs != dir->vn_fs) {
+			continue;
+		}
+		if (negative_only && e->nc_vn != NULL) {
+			continue;
+		}
+		nc_remove(e);
+		nc_purged++;
+	}
+
+	vfs_biglock_release();
+}
+
+/*
+ * Drop FS's entries: only the negative ones if NEGATIVE_ONLY is set
+ * (a name was created), or all of them (a name went away, or the
+ * filesystem is being unmounted).
+ */
+void
+namecache_purge(struct fs *fs, bool negative_only)
+{
+	struct ncentry *e, *next;
+
+	if (fs == NULL) {
+		return;
+	}
+
+	vfs_biglock_acquire();
+
+	for (e = nc_lruhead; e != NULL; e = next) {
+		next = e->nc_lrunext;
+		if (e->nc_dir->vn_fs != fs) {
+			continue;
+		}
+		if (negative_only && e->nc_vn != NULL) {
+			continue;
+		}
+		nc_remove(e);
+		nc_purged++;
+	}
+
+	vfs_biglock_release();
+}
+
+void
+namecache_printstats(void)
+{
+	unsigned lookups;
+
+	vfs_biglock_acquire();
+
+	lookups = nc_hits + nc_neghits + nc_misses;
+	kprintf("Name cache: %u/%u entries\n", nc_count, NC_MAXENTRIES);
+	kprintf("  lookups %u: hits %u, negative hits %u, misses %u",
+		lookups, nc_hits, nc_neghits, nc_misses);
+	if (lookups > 0) {
+		kprintf(" (%u%% hit)",
+			(unsigned)((nc_hits + nc_neghits) * 100ULL / lookups));
+	}
+	kprintf("\n");
+	kprintf("  evictions %u, purged %u\n", nc_evictions, nc_purged);
+
+	vfs_biglock_release();
+}
+
+#endif /* OPT_A3 */
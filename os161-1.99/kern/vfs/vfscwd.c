@@ -41,6 +41,7 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include "opt-A3.h"
 
 /*
  * Get current directory as a vnode.
@@ -160,9 +161,14 @@ vfs_getcwd(struct uio *uio)
 
 	name = FSOP_GETVOLNAME(cwd->vn_fs);
 	if (name==NULL) {
+#if OPT_A3
+		/* takes the device list lock, not the biglock */
+		name = vfs_getdevname(cwd->vn_fs);
+#else
 		vfs_biglock_acquire();
 		name = vfs_getdevname(cwd->vn_fs);
 		vfs_biglock_release();
+#endif /* OPT_A3 */
 	}
 	KASSERT(name != NULL);
 
@@ -43,6 +43,10 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <namecache.h>
+#endif /* OPT_A3 */
 
 /*
  * Structure for a single named device.
@@ -87,6 +91,19 @@ DEFARRAY(knowndev, /*no inline*/);
 
 static struct knowndevarray *knowndevs;
 
+#if OPT_A3
+/*
+ * knowndevs_lock protects knowndevs and the entries in it, so that
+ * looking a device up by name only needs a read lock and lookups on
+ * different cpus don't take turns on vfs_biglock. Anything that
+ * changes the list, including mounting and unmounting, takes it for
+ * writing. The lookups go on into vnode and fs operations that take
+ * vfs_biglock, so the order is always knowndevs_lock first: never
+ * wait for it while holding vfs_biglock.
+ */
+static struct rwlock *knowndevs_lock;
+#endif /* OPT_A3 */
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -102,6 +119,12 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
+#if OPT_A3
+	knowndevs_lock = rwlock_create("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
+#endif /* OPT_A3 */
 
 	vfs_biglock = lock_create("vfs_biglock");
 	if (vfs_biglock==NULL) {
@@ -145,6 +168,44 @@ vfs_biglock_do_i_hold(void)
 	return lock_do_i_hold(vfs_biglock);
 }
 
+/*
+ * Lock knowndevs to change it (or what is mounted on it).
+ */
+static
+void
+knowndevs_change_begin(void)
+{
+#if OPT_A3
+	KASSERT(!vfs_biglock_do_i_hold());
+	rwlock_acquire_write(knowndevs_lock);
+#endif /* OPT_A3 */
+	vfs_biglock_acquire();
+}
+
+static
+void
+knowndevs_change_end(void)
+{
+	vfs_biglock_release();
+#if OPT_A3
+	rwlock_release_write(knowndevs_lock);
+#endif /* OPT_A3 */
+}
+
+/*
+ * True if the caller has knowndevs locked for changing it.
+ */
+static
+bool
+knowndevs_changing(void)
+{
+#if OPT_A3
+	return rwlock_do_i_hold_write(knowndevs_lock);
+#else
+	return vfs_biglock_do_i_hold();
+#endif /* OPT_A3 */
+}
+
 /*
  * Global sync function - call FSOP_SYNC on all devices.
  */
@@ -154,6 +215,9 @@ vfs_sync(void)
 	struct knowndev *dev;
 	unsigned i, num;
 
+#if OPT_A3
+	rwlock_acquire_read(knowndevs_lock);
+#endif /* OPT_A3 */
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
@@ -165,22 +229,24 @@ vfs_sync(void)
 	}
 
 	vfs_biglock_release();
+#if OPT_A3
+	rwlock_release_read(knowndevs_lock);
+#endif /* OPT_A3 */
 
 	return 0;
 }
 
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * back an appropriate vnode. Call with knowndevs locked.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **result)
+findroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -250,19 +316,34 @@ vfs_getroot(const char *devname, struct vnode **result)
 	return ENODEV;
 }
 
+int
+vfs_getroot(const char *devname, struct vnode **result)
+{
+	int err;
+
+#if OPT_A3
+	KASSERT(!vfs_biglock_do_i_hold());
+	rwlock_acquire_read(knowndevs_lock);
+	err = findroot(devname, result);
+	rwlock_release_read(knowndevs_lock);
+#else
+	KASSERT(vfs_biglock_do_i_hold());
+	err = findroot(devname, result);
+#endif /* OPT_A3 */
+	return err;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
+ * Call with knowndevs locked.
  */
+static
 const char *
-vfs_getdevname(struct fs *fs)
+finddevname(struct fs *fs)
 {
 	struct knowndev *kd;
 	unsigned i, num;
 
-	KASSERT(fs != NULL);
-
-	KASSERT(vfs_biglock_do_i_hold());
-
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -281,6 +362,25 @@ vfs_getdevname(struct fs *fs)
 	return NULL;
 }
 
+const char *
+vfs_getdevname(struct fs *fs)
+{
+	const char *name;
+
+	KASSERT(fs != NULL);
+
+#if OPT_A3
+	KASSERT(!vfs_biglock_do_i_hold());
+	rwlock_acquire_read(knowndevs_lock);
+	name = finddevname(fs);
+	rwlock_release_read(knowndevs_lock);
+#else
+	KASSERT(vfs_biglock_do_i_hold());
+	name = finddevname(fs);
+#endif /* OPT_A3 */
+	return name;
+}
+
 /*
  * Assemble the name for a raw device from the name for the regular device.
  */
@@ -338,7 +438,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	unsigned i, num;
 	struct knowndev *kd;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(knowndevs_changing());
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -378,7 +478,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	unsigned index;
 	int result;
 
-	vfs_biglock_acquire();
+	knowndevs_change_begin();
 
 	name = kstrdup(dname);
 	if (name==NULL) {
@@ -412,7 +512,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 
 	if (badnames(name, rawname, volname)) {
-		vfs_biglock_release();
+		knowndevs_change_end();
 		return EEXIST;
 	}
 
@@ -423,7 +523,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		dev->d_devnumber = index+1;
 	}
 
-	vfs_biglock_release();
+	knowndevs_change_end();
 	return result;
 
  nomem:
@@ -441,7 +541,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		kfree(kd);
 	}
 	
-	vfs_biglock_release();
+	knowndevs_change_end();
 	return ENOMEM;
 }
 
@@ -480,7 +580,7 @@ findmount(const char *devname, struct knowndev **result)
 	unsigned i, num;
 	bool found = false;
 
-	KASSERT(vfs_biglock_do_i_hold());
+	KASSERT(knowndevs_changing());
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -514,16 +614,16 @@ vfs_mount(const char *devname, void *data,
 	struct fs *fs;
 	int result;
 
-	vfs_biglock_acquire();
+	knowndevs_change_begin();
 
 	result = findmount(devname, &kd);
 	if (result) {
-		vfs_biglock_release();
+		knowndevs_change_end();
 		return result;
 	}
 
 	if (kd->kd_fs != NULL) {
-		vfs_biglock_release();
+		knowndevs_change_end();
 		return EBUSY;
 	}
 	KASSERT(kd->kd_rawname != NULL);
@@ -531,7 +631,7 @@ vfs_mount(const char *devname, void *data,
 
 	result = mountfunc(data, kd->kd_device, &fs);
 	if (result) {
-		vfs_biglock_release();
+		knowndevs_change_end();
 		return result;
 	}
 
@@ -543,7 +643,7 @@ vfs_mount(const char *devname, void *data,
 	kprintf("vfs: Mounted %s: on %s\n",
 		volname ? volname : kd->kd_name, kd->kd_name);
 
-	vfs_biglock_release();
+	knowndevs_change_end();
 	return 0;
 }
 
@@ -557,7 +657,7 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
-	vfs_biglock_acquire();
+	knowndevs_change_begin();
 
 	result = findmount(devname, &kd);
 	if (result) {
@@ -571,6 +671,11 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+#if OPT_A3
+	/* let go of the vnodes the name cache is holding */
+	namecache_purge(kd->kd_fs, false);
+#endif /* OPT_A3 */
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -589,7 +694,7 @@ vfs_unmount(const char *devname)
 	KASSERT(result==0);
 
  fail:
-	vfs_biglock_release();
+	knowndevs_change_end();
 	return result;
 }
 
@@ -603,7 +708,7 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
-	vfs_biglock_acquire();
+	knowndevs_change_begin();
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -619,6 +724,10 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+#if OPT_A3
+		namecache_purge(dev->kd_fs, false);
+#endif /* OPT_A3 */
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -650,7 +759,7 @@ vfs_unmountall(void)
 		dev->kd_fs = NULL;
 	}
 
-	vfs_biglock_release();
+	knowndevs_change_end();
 
 	return 0;
 }
@@ -39,6 +39,10 @@
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <namecache.h>
+#endif /* OPT_A3 */
 
 static struct vnode *bootfs_vnode = NULL;
 
@@ -75,6 +79,39 @@ vfs_setbootfs(const char *fsname)
 	int result;
 	struct vnode *newguy;
 
+#if OPT_A3
+	/*
+	 * Looking the name up takes the device list lock, which can't
+	 * be waited for under vfs_biglock; only the switch itself
+	 * needs the biglock.
+	 */
+	snprintf(tmp, sizeof(tmp)-1, "%s", fsname);
+	s = strchr(tmp, ':');
+	if (s) {
+		/* If there's a colon, it must be at the end */
+		if (strlen(s)>0) {
+			return EINVAL;
+		}
+	}
+	else {
+		strcat(tmp, ":");
+	}
+
+	result = vfs_chdir(tmp);
+	if (result) {
+		return result;
+	}
+
+	result = vfs_getcurdir(&newguy);
+	if (result) {
+		return result;
+	}
+
+	vfs_biglock_acquire();
+	change_bootfs(newguy);
+	vfs_biglock_release();
+	return 0;
+#else
 	vfs_biglock_acquire();
 
 	snprintf(tmp, sizeof(tmp)-1, "%s", fsname);
@@ -106,6 +143,7 @@ vfs_setbootfs(const char *fsname)
 
 	vfs_biglock_release();
 	return 0;
+#endif /* OPT_A3 */
 }
 
 /*
@@ -123,6 +161,9 @@ vfs_clearbootfs(void)
 /*
  * Common code to pull the device name, if any, off the front of a
  * path and choose the vnode to begin the name lookup relative to.
+ *
+ * With OPT_A3 this is called without vfs_biglock, so that device
+ * names are looked up under the device list's read lock only.
  */
 
 static
@@ -133,7 +174,11 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	struct vnode *vn;
 	int result;
 
+#if OPT_A3
+	KASSERT(!vfs_biglock_do_i_hold());
+#else
 	KASSERT(vfs_biglock_do_i_hold());
+#endif /* OPT_A3 */
 
 	/*
 	 * Locate the first colon or slash.
@@ -188,11 +233,22 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	KASSERT(colon==0 || slash==0);
 
 	if (path[0]=='/') {
+#if OPT_A3
+		vfs_biglock_acquire();
+		if (bootfs_vnode==NULL) {
+			vfs_biglock_release();
+			return ENOENT;
+		}
+		VOP_INCREF(bootfs_vnode);
+		*startvn = bootfs_vnode;
+		vfs_biglock_release();
+#else
 		if (bootfs_vnode==NULL) {
 			return ENOENT;
 		}
 		VOP_INCREF(bootfs_vnode);
 		*startvn = bootfs_vnode;
+#endif /* OPT_A3 */
 	}
 	else {
 		KASSERT(path[0]==':');
@@ -235,6 +291,14 @@ vfs_lookparent(char *path, struct vnode **retval,
 	struct vnode *startvn;
 	int result;
 
+#if OPT_A3
+	result = getdevice(path, &path, &startvn);
+	if (result) {
+		return result;
+	}
+
+	vfs_biglock_acquire();
+#else
 	vfs_biglock_acquire();
 
 	result = getdevice(path, &path, &startvn);
@@ -242,6 +306,7 @@ vfs_lookparent(char *path, struct vnode **retval,
 		vfs_biglock_release();
 		return result;
 	}
+#endif /* OPT_A3 */
 
 	if (strlen(path)==0) {
 		/*
@@ -267,6 +332,14 @@ vfs_lookup(char *path, struct vnode **retval)
 	struct vnode *startvn;
 	int result;
 
+#if OPT_A3
+	result = getdevice(path, &path, &startvn);
+	if (result) {
+		return result;
+	}
+
+	vfs_biglock_acquire();
+#else
 	vfs_biglock_acquire();
 
 	result = getdevice(path, &path, &startvn);
@@ -274,6 +347,7 @@ vfs_lookup(char *path, struct vnode **retval)
 		vfs_biglock_release();
 		return result;
 	}
+#endif /* OPT_A3 */
 
 	if (strlen(path)==0) {
 		*retval = startvn;
@@ -281,7 +355,23 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
+#if OPT_A3
+	if (namecache_lookup(startvn, path, retval)) {
+		VOP_DECREF(startvn);
+		vfs_biglock_release();
+		return *retval == NULL ? ENOENT : 0;
+	}
+
+	result = VOP_LOOKUP(startvn, path, retval);
+	if (result == 0) {
+		namecache_enter(startvn, path, *retval);
+	}
+	else if (result == ENOENT) {
+		namecache_enter(startvn, path, NULL);
+	}
+#else
 	result = VOP_LOOKUP(startvn, path, retval);
+#endif /* OPT_A3 */
 
 	VOP_DECREF(startvn);
 	vfs_biglock_release();
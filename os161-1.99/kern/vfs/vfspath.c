@@ -38,6 +38,10 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <namecache.h>
+#endif /* OPT_A3 */
 
 
 /* Does most of the work for open(). */
@@ -73,7 +77,15 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			return result;
 		}
 
+#if OPT_A3
+		// so no lookup caches the name as missing in between
+		vfs_biglock_acquire();
 		result = VOP_CREAT(dir, name, excl, mode, &vn);
+		namecache_invalidate(dir, name, true);
+		vfs_biglock_release();
+#else
+		result = VOP_CREAT(dir, name, excl, mode, &vn);
+#endif /* OPT_A3 */
 
 		VOP_DECREF(dir);
 	}
@@ -149,7 +161,15 @@ vfs_remove(char *path)
 		return result;
 	}
 
+#if OPT_A3
+	// so no lookup caches the old name in between
+	vfs_biglock_acquire();
+	result = VOP_REMOVE(dir, name);
+	namecache_invalidate(dir, name, false);
+	vfs_biglock_release();
+#else
 	result = VOP_REMOVE(dir, name);
+#endif /* OPT_A3 */
 	VOP_DECREF(dir);
 
 	return result;
@@ -182,7 +202,16 @@ vfs_rename(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+#if OPT_A3
+	// both names change; no lookup may cache either in between
+	vfs_biglock_acquire();
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	namecache_invalidate(olddir, oldname, false);
+	namecache_invalidate(newdir, newname, false);
+	vfs_biglock_release();
+#else
+	result = VOP_RENAME(olddir, oldname, newdir, newname);
+#endif /* OPT_A3 */
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -216,7 +245,14 @@ vfs_link(char *oldpath, char *newpath)
 		return EXDEV;
 	}
 
+#if OPT_A3
+	vfs_biglock_acquire();
+	result = VOP_LINK(newdir, newname, oldfile);
+	namecache_invalidate(newdir, newname, true);
+	vfs_biglock_release();
+#else
 	result = VOP_LINK(newdir, newname, oldfile);
+#endif /* OPT_A3 */
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -243,7 +279,14 @@ vfs_symlink(const char *contents, char *path)
 		return result;
 	}
 
+#if OPT_A3
+	vfs_biglock_acquire();
 	result = VOP_SYMLINK(newdir, newname, contents);
+	namecache_invalidate(newdir, newname, true);
+	vfs_biglock_release();
+#else
+	result = VOP_SYMLINK(newdir, newname, contents);
+#endif /* OPT_A3 */
 	VOP_DECREF(newdir);
 
 	return result;
@@ -289,7 +332,14 @@ vfs_mkdir(char *path, mode_t mode)
 		return result;
 	}
 
+#if OPT_A3
+	vfs_biglock_acquire();
+	result = VOP_MKDIR(parent, name, mode);
+	namecache_invalidate(parent, name, true);
+	vfs_biglock_release();
+#else
 	result = VOP_MKDIR(parent, name, mode);
+#endif /* OPT_A3 */
 
 	VOP_DECREF(parent);
 
@@ -311,7 +361,14 @@ vfs_rmdir(char *path)
 		return result;
 	}
 
+#if OPT_A3
+	vfs_biglock_acquire();
+	result = VOP_RMDIR(parent, name);
+	namecache_invalidate(parent, name, false);
+	vfs_biglock_release();
+#else
 	result = VOP_RMDIR(parent, name);
+#endif /* OPT_A3 */
 
 	VOP_DECREF(parent);
 
@@ -0,0 +1,842 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <array.h>
+#include <uio.h>
+#include <stat.h>
+#include <vnode.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vm.h>
+#include <uw-vmstats.h>
+
+/*
+ * Paged address spaces. An address space is a list of regions plus a
+ * page table; nothing is backed by physical memory until vm_fault
+ * touches it. Regions holding ELF segments remember where in the
+ * executable their contents are, and hold a reference to its vnode.
+ * So do mmap()ed files, which sit below the stack. The heap starts out
+ * empty just above the segments and grows up with sbrk.
+ */
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->as_regions = array_create();
+	if (as->as_regions == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		array_destroy(as->as_regions);
+		kfree(as);
+		return NULL;
+	}
+
+	as->as_heap = NULL;
+	as->as_heaptop = 0;
+	as->as_loading = false;
+	as->as_asid = 0;
+	as->as_asidgen = 0;
+	as->as_cpu = NULL;
+	bzero(as->as_stlb, sizeof(as->as_stlb));
+	return as;
+}
+
+static int as_sync_region(struct addrspace *as, struct region *rg,
+			  vaddr_t start, vaddr_t end);
+
+void
+as_destroy(struct addrspace *as)
+{
+	KASSERT(as != NULL);
+
+	// what was stored in shared mappings belongs to the files
+	unsigned nr = array_num(as->as_regions);
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *rg = array_get(as->as_regions, i);
+		if (rg->rg_shared) {
+			as_sync_region(as, rg, rg->rg_vbase,
+				       rg->rg_vbase + rg->rg_npages * PAGE_SIZE);
+		}
+	}
+
+	pt_destroy(as->as_pt);
+
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *rg = array_get(as->as_regions, i);
+		if (rg->rg_vn != NULL) {
+			VOP_DECREF(rg->rg_vn);
+		}
+		kfree(rg);
+	}
+	array_setsize(as->as_regions, 0);
+	array_destroy(as->as_regions);
+
+	kfree(as);
+}
+
+/*
+ * Address space IDs. Every address space is tagged with an ASID of the
+ * current generation, so switching between processes does not flush
+ * the TLB. When the ASIDs run out a new generation starts, and each
+ * cpu flushes its TLB the first time it activates an address space
+ * after that. An address space that moves to another cpu also gets a
+ * new ASID, which strands its entries on the old cpu, so only one cpu
+ * ever holds live entries for it. ASID 0 is never handed out.
+ */
+static struct spinlock asid_lock = SPINLOCK_INITIALIZER;
+static uint32_t asid_gen = 1;
+static uint32_t asid_next = 1;
+
+// throw away every TLB entry on this cpu; interrupts off
+static
+void
+as_flush_tlb(void)
+{
+	int i;
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	// the invalid entries left ASID 0 in entryhi
+	tlb_setasid(curcpu->c_asid << TLBHI_PID_SHIFT);
+	curcpu->c_tlb_next = 0;
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+void
+as_activate(void)
+{
+	struct addrspace *as;
+	struct cpu *c;
+	int spl;
+
+	as = curproc_getas();
+	/* Kernel threads don't have an address spaces to activate */
+	if (as == NULL) {
+		return;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	c = curcpu->c_self;
+
+	spinlock_acquire(&asid_lock);
+	if (as->as_asidgen != asid_gen || as->as_cpu != c) {
+		if (asid_next == NUM_ASID) {
+			asid_gen++;
+			asid_next = 1;
+		}
+		as->as_asid = asid_next++;
+		as->as_asidgen = asid_gen;
+		as->as_cpu = c;
+	}
+	c->c_asid = as->as_asid;
+	if (c->c_asidgen != asid_gen) {
+		// the TLB may hold entries whose ASIDs were handed out again
+		c->c_asidgen = asid_gen;
+		as_flush_tlb();
+	} else {
+		tlb_setasid(c->c_asid << TLBHI_PID_SHIFT);
+	}
+	spinlock_release(&asid_lock);
+
+	splx(spl);
+}
+
+void
+as_deactivate(void)
+{
+	// our entries are tagged, they can stay in the TLB
+}
+
+/*
+ * Drop every translation of the current address space, in the TLB and
+ * in the software TLB: moving to a fresh ASID is cheaper than a flush.
+ */
+static
+void
+as_retag(struct addrspace *as)
+{
+	KASSERT(as == curproc_getas());
+
+	bzero(as->as_stlb, sizeof(as->as_stlb));
+	as->as_asidgen = 0;
+	as_activate();
+}
+
+uint32_t
+as_tlbhi(struct addrspace *as, vaddr_t vaddr)
+{
+	return (vaddr & TLBHI_VPAGE) | (as->as_asid << TLBHI_PID_SHIFT);
+}
+
+void
+as_stlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	struct stlb_entry *st = &as->as_stlb[AS_STLB_INDEX(vaddr)];
+
+	if (st->st_vaddr == vaddr) {
+		st->st_elo = 0;
+	}
+}
+
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned nr = array_num(as->as_regions);
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *rg = array_get(as->as_regions, i);
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+
+	return NULL;
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	struct region *rg;
+	int result;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	// the MIPS cannot keep pages readable-but-not-executable
+	(void)readable;
+	(void)executable;
+
+	if (sz == 0 || vaddr + sz > USERSPACETOP || vaddr + sz < vaddr) {
+		return EFAULT;
+	}
+
+	// segments may share a page at their edges, but must not nest
+	if (as_find_region(as, vaddr) != NULL &&
+	    as_find_region(as, vaddr + sz - 1) != NULL) {
+		return EINVAL;
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = sz / PAGE_SIZE;
+	rg->rg_writeable = writeable != 0;
+	rg->rg_vn = NULL;
+	rg->rg_offset = 0;
+	rg->rg_segbase = vaddr;
+	rg->rg_filesize = 0;
+	rg->rg_mapped = false;
+	rg->rg_shared = false;
+
+	result = array_add(as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+
+	return 0;
+}
+
+int
+as_define_file(struct addrspace *as, struct vnode *v, off_t offset,
+	       vaddr_t vaddr, size_t filesize)
+{
+	struct region *rg = NULL;
+
+	// the segment's own region, which may share its first page with another
+	unsigned nr = array_num(as->as_regions);
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *r = array_get(as->as_regions, i);
+		if (r->rg_vn == NULL && vaddr >= r->rg_vbase &&
+		    vaddr < r->rg_vbase + r->rg_npages * PAGE_SIZE) {
+			rg = r;
+			break;
+		}
+	}
+	if (rg == NULL) {
+		return EINVAL;
+	}
+	if (filesize == 0) {
+		// all bss
+		return 0;
+	}
+	if (vaddr + filesize > rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return ENOEXEC;
+	}
+
+	VOP_INCREF(v);
+	rg->rg_vn = v;
+	rg->rg_offset = offset;
+	rg->rg_segbase = vaddr;
+	rg->rg_filesize = filesize;
+	return 0;
+}
+
+/*
+ * Segments may share a page at their edges, so look at every region,
+ * not just the one as_find_region would return. A mapped file may have
+ * shrunk since it was mapped; what is gone reads as zeroes.
+ */
+int
+as_fill_page(struct addrspace *as, vaddr_t vaddr, vaddr_t kva, bool *fromfile)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	*fromfile = false;
+
+	unsigned nr = array_num(as->as_regions);
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *rg = array_get(as->as_regions, i);
+		vaddr_t start, end;
+
+		if (rg->rg_vn == NULL) {
+			continue;
+		}
+		start = vaddr > rg->rg_segbase ? vaddr : rg->rg_segbase;
+		end = rg->rg_segbase + rg->rg_filesize;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		uio_kinit(&iov, &u, (void *)(kva + (start - vaddr)), end - start,
+			  rg->rg_offset + (start - rg->rg_segbase), UIO_READ);
+		result = VOP_READ(rg->rg_vn, &u);
+		if (result) {
+			return result;
+		}
+		if (u.uio_resid != 0 && !rg->rg_mapped) {
+			/* short read; problem with executable? */
+			kprintf("ELF: short read on segment - file truncated?\n");
+			return ENOEXEC;
+		}
+		*fromfile = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Highest hole of SZ bytes below the stack, or 0 if there is none.
+ * The search runs down from the stack, leaving the heap as much room
+ * to grow as it can.
+ */
+static
+vaddr_t
+as_find_hole(struct addrspace *as, size_t sz)
+{
+	vaddr_t top = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+
+	while (top > sz) {
+		vaddr_t base = top - sz;
+		vaddr_t next = top;
+
+		unsigned nr = array_num(as->as_regions);
+		for (unsigned i = 0; i < nr; i++) {
+			struct region *rg = array_get(as->as_regions, i);
+			if (rg->rg_vbase < top &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > base &&
+			    rg->rg_vbase < next) {
+				next = rg->rg_vbase;
+			}
+		}
+		if (next == top) {
+			return base;
+		}
+		// try again just below whatever was in the way
+		top = next;
+	}
+
+	return 0;
+}
+
+int
+as_map_file(struct addrspace *as, struct vnode *v, off_t offset, size_t len,
+	    bool writeable, bool shared, vaddr_t *vaddr)
+{
+	struct region *rg;
+	struct stat st;
+	size_t sz;
+	vaddr_t base;
+	int result;
+
+	KASSERT((offset & ~(off_t)PAGE_FRAME) == 0);
+
+	sz = (len + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (sz == 0) {
+		return EINVAL;
+	}
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+
+	base = as_find_hole(as, sz);
+	if (base == 0) {
+		return ENOMEM;
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = base;
+	rg->rg_npages = sz / PAGE_SIZE;
+	rg->rg_writeable = writeable;
+	rg->rg_vn = v;
+	rg->rg_offset = offset;
+	rg->rg_segbase = base;
+	// past the end of the file are zeroes, which are never written back
+	if (offset >= st.st_size) {
+		rg->rg_filesize = 0;
+	} else if (st.st_size - offset < (off_t)len) {
+		rg->rg_filesize = st.st_size - offset;
+	} else {
+		rg->rg_filesize = len;
+	}
+	rg->rg_mapped = true;
+	rg->rg_shared = shared;
+
+	result = array_add(as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	VOP_INCREF(v);
+
+	*vaddr = base;
+	return 0;
+}
+
+/*
+ * Write the page behind PTE at VA back to RG's file, if it was stored
+ * to since it was last written back, using the kernel page BUF. The
+ * page is copied out, and marked clean, under coremap_lock; stores
+ * after that must fault again to mark it dirty, so the caller has to
+ * drop the address space's translations before it runs again.
+ */
+static
+int
+as_writeback_page(struct region *rg, pte_t *pte, vaddr_t va, vaddr_t buf)
+{
+	struct coremap_entry *e;
+	struct iovec iov;
+	struct uio u;
+	pte_t entry;
+	size_t len;
+	int result;
+
+	while (1) {
+		coremap_lock_acquire();
+		entry = *pte;
+		if (!(entry & PTE_DIRTY)) {
+			coremap_lock_release();
+			return 0;
+		}
+		if (entry & PTE_SWAPPED) {
+			break;
+		}
+		e = coremap_entry(entry & PTE_FRAME);
+		if (e->busy) {
+			coremap_wait();
+			continue;
+		}
+		memmove((void *)buf,
+			(const void *)PADDR_TO_KVADDR(entry & PTE_FRAME),
+			PAGE_SIZE);
+		break;
+	}
+	*pte = entry & ~PTE_DIRTY;
+	coremap_lock_release();
+
+	if (entry & PTE_SWAPPED) {
+		// only we page our pages in, so the slot stays put
+		result = swap_in(PTE_SLOT(entry), buf - MIPS_KSEG0);
+		if (result) {
+			goto fail;
+		}
+	}
+
+	// the part of the page the file has
+	len = rg->rg_segbase + rg->rg_filesize - va;
+	if (len > PAGE_SIZE) {
+		len = PAGE_SIZE;
+	}
+	uio_kinit(&iov, &u, (void *)buf, len,
+		  rg->rg_offset + (va - rg->rg_segbase), UIO_WRITE);
+	result = VOP_WRITE(rg->rg_vn, &u);
+	if (result == 0) {
+		return 0;
+	}
+
+ fail:
+	coremap_lock_acquire();
+	*pte |= PTE_DIRTY;
+	coremap_lock_release();
+	return result;
+}
+
+// write back RG's dirty pages between START and END
+static
+int
+as_sync_region(struct addrspace *as, struct region *rg,
+	       vaddr_t start, vaddr_t end)
+{
+	vaddr_t va, buf, fileend;
+	int result = 0;
+
+	KASSERT(rg->rg_mapped && rg->rg_shared);
+
+	fileend = rg->rg_segbase + rg->rg_filesize;
+	if (start < rg->rg_vbase) {
+		start = rg->rg_vbase;
+	}
+	if (end > fileend) {
+		end = fileend;
+	}
+	if (start >= end) {
+		return 0;
+	}
+
+	buf = alloc_kpages(1);
+	if (buf == 0) {
+		return ENOMEM;
+	}
+	for (va = start & PAGE_FRAME; va < end && result == 0; va += PAGE_SIZE) {
+		pte_t *pte = pt_lookup(as->as_pt, va, false);
+		// a page never touched is still the same as the file
+		if (pte != NULL && (*pte & PTE_DIRTY)) {
+			result = as_writeback_page(rg, pte, va, buf);
+		}
+	}
+	free_kpages(buf);
+	return result;
+}
+
+int
+as_sync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	vaddr_t va, end = vaddr + len;
+	int result = 0;
+
+	if (end < vaddr) {
+		return ENOMEM;
+	}
+	// every page in the range has to be mapped
+	for (va = vaddr & PAGE_FRAME; va < end; ) {
+		struct region *rg = as_find_region(as, va);
+		if (rg == NULL) {
+			return ENOMEM;
+		}
+		va = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	}
+
+	unsigned nr = array_num(as->as_regions);
+	for (unsigned i = 0; i < nr && result == 0; i++) {
+		struct region *rg = array_get(as->as_regions, i);
+		if (rg->rg_shared) {
+			result = as_sync_region(as, rg, vaddr, vaddr + len);
+		}
+	}
+
+	// written-back pages must fault again to be marked dirty
+	as_retag(as);
+	return result;
+}
+
+int
+as_unmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	vaddr_t end = vaddr + ((len + PAGE_SIZE - 1) & PAGE_FRAME);
+	unsigned i, nr;
+	int result;
+
+	if ((vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || end <= vaddr) {
+		return EINVAL;
+	}
+
+	// regions are never split: each mapping is removed whole or not at all
+	nr = array_num(as->as_regions);
+	for (i = 0; i < nr; i++) {
+		struct region *rg = array_get(as->as_regions, i);
+		vaddr_t rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+
+		if (rg->rg_vbase >= end || rgend <= vaddr) {
+			continue;
+		}
+		if (!rg->rg_mapped ||
+		    rg->rg_vbase < vaddr || rgend > end) {
+			return EINVAL;
+		}
+		if (rg->rg_shared) {
+			result = as_sync_region(as, rg, rg->rg_vbase, rgend);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	i = 0;
+	while (i < array_num(as->as_regions)) {
+		struct region *rg = array_get(as->as_regions, i);
+		vaddr_t rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+
+		if (rg->rg_vbase >= end || rgend <= vaddr) {
+			i++;
+			continue;
+		}
+		for (vaddr_t va = rg->rg_vbase; va < rgend; va += PAGE_SIZE) {
+			pte_t *pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && *pte != 0) {
+				coremap_unmap(pte);
+			}
+		}
+		array_remove(as->as_regions, i);
+		VOP_DECREF(rg->rg_vn);
+		kfree(rg);
+	}
+
+	as_retag(as);
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	// let load_elf write into read-only segments; pages arrive on demand
+	as->as_loading = true;
+	return 0;
+}
+
+/*
+ * Put an empty heap right above the highest segment. It is an ordinary
+ * zero-filled region whose size sbrk changes.
+ */
+static
+int
+as_define_heap(struct addrspace *as)
+{
+	struct region *rg;
+	vaddr_t base = 0;
+	int result;
+
+	unsigned nr = array_num(as->as_regions);
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *r = array_get(as->as_regions, i);
+		vaddr_t end = r->rg_vbase + r->rg_npages * PAGE_SIZE;
+		if (end > base) {
+			base = end;
+		}
+	}
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = base;
+	rg->rg_npages = 0;
+	rg->rg_writeable = true;
+	rg->rg_vn = NULL;
+	rg->rg_offset = 0;
+	rg->rg_segbase = base;
+	rg->rg_filesize = 0;
+	rg->rg_mapped = false;
+	rg->rg_shared = false;
+
+	result = array_add(as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	as->as_heap = rg;
+	as->as_heaptop = base;
+	return 0;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldtop)
+{
+	struct region *heap = as->as_heap;
+	vaddr_t top, newtop, end, newend;
+
+	if (heap == NULL) {
+		return EINVAL;
+	}
+	top = as->as_heaptop;
+	if (amount < 0 && 0 - (vaddr_t)amount > top - heap->rg_vbase) {
+		return EINVAL;
+	}
+	newtop = top + amount;
+	if (amount > 0 && (newtop < top || newtop > USERSPACETOP)) {
+		return ENOMEM;
+	}
+
+	end = heap->rg_vbase + heap->rg_npages * PAGE_SIZE;
+	newend = (newtop + PAGE_SIZE - 1) & PAGE_FRAME;
+	if (newend > end) {
+		// it may not grow into a mapping or the stack
+		unsigned nr = array_num(as->as_regions);
+		for (unsigned i = 0; i < nr; i++) {
+			struct region *rg = array_get(as->as_regions, i);
+			if (rg != heap && rg->rg_vbase < newend &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > end) {
+				return ENOMEM;
+			}
+		}
+	}
+	else if (newend < end) {
+		for (vaddr_t va = newend; va < end; va += PAGE_SIZE) {
+			pte_t *pte = pt_lookup(as->as_pt, va, false);
+			if (pte != NULL && *pte != 0) {
+				coremap_unmap(pte);
+			}
+		}
+		as_retag(as);
+	}
+
+	heap->rg_npages = (newend - heap->rg_vbase) / PAGE_SIZE;
+	as->as_heaptop = newtop;
+	*oldtop = top;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	int result;
+
+	as->as_loading = false;
+
+	result = as_define_heap(as);
+	if (result) {
+		return result;
+	}
+
+	// drop the writeable mappings made while loading
+	as_retag(as);
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	int result;
+
+	result = as_define_region(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+				  VM_STACKPAGES * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	int result;
+
+	new = as_create();
+	if (new==NULL) {
+		return ENOMEM;
+	}
+
+	unsigned nr = array_num(old->as_regions);
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *org = array_get(old->as_regions, i);
+		struct region *nrg = kmalloc(sizeof(*nrg));
+		if (nrg == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*nrg = *org;
+		if (org == old->as_heap) {
+			new->as_heap = nrg;
+			new->as_heaptop = old->as_heaptop;
+		}
+
+		result = array_add(new->as_regions, nrg, NULL);
+		if (result) {
+			kfree(nrg);
+			as_destroy(new);
+			return result;
+		}
+		if (nrg->rg_vn != NULL) {
+			VOP_INCREF(nrg->rg_vn);
+		}
+	}
+
+	/*
+	 * A page of a MAP_SHARED mapping that first came in after the
+	 * fork would come into a frame of each space's own, so bring
+	 * them all in now. Shared frames are not evicted, so a shared
+	 * mapping stays resident until all but one space has let go.
+	 */
+	for (unsigned i = 0; i < nr; i++) {
+		struct region *rg = array_get(old->as_regions, i);
+		if (!rg->rg_shared) {
+			continue;
+		}
+		for (size_t p = 0; p < rg->rg_npages; p++) {
+			result = vm_populate(old, rg->rg_vbase + p * PAGE_SIZE);
+			if (result) {
+				as_destroy(new);
+				return result;
+			}
+		}
+	}
+
+	// share every resident page with the new space, copy-on-write
+	// outside of MAP_SHARED mappings
+	result = pt_copy(old->as_pt, new->as_pt, new);
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+
+	// our cached translations may still allow writes to the shared pages
+	as_retag(old);
+
+	*ret = new;
+	return 0;
+}
+
+#endif /* OPT_A3 */
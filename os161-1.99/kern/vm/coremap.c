@@ -2,7 +2,20 @@
 
 #if OPT_A3
 
+#include <kern/errno.h>
 #include <coremap.h>
+#include <thread.h>
+#include <wchan.h>
+#include <swap.h>
+#include <addrspace.h>
+
+/*
+ * Physical pages are handed out by a buddy allocator that lives inside
+ * the coremap itself. Every free block of 2^k pages is threaded onto
+ * freelist[k] through the next/prev indices of its first entry, so a
+ * single page comes off a list in O(1) and a run of npages costs at
+ * most COREMAP_MAXORDER splits or merges.
+ */
 
 // use an array of struct coremap_entry to keep all physical pages info
 static struct coremap_entry *coremap_array;
@@ -14,12 +27,49 @@ static uint32_t lastpage;
 static bool vm_got = false;
 static paddr_t firstaddr;
 static paddr_t lastaddr;
+// head of the free blocks of each order
+static uint32_t freelist[COREMAP_MAXORDER + 1];
+// pages on the free lists
+static uint32_t coremap_nfree;
+
+// put the free block starting at index onto its list
+static
+void
+freelist_push(uint32_t index, int order)
+{
+	struct coremap_entry *e = &coremap_array[index];
+
+	e->order = order;
+	e->prev = COREMAP_NONE;
+	e->next = freelist[order];
+	if (e->next != COREMAP_NONE) {
+		coremap_array[e->next].prev = index;
+	}
+	freelist[order] = index;
+}
+
+// take the free block starting at index off its list
+static
+void
+freelist_remove(uint32_t index)
+{
+	struct coremap_entry *e = &coremap_array[index];
+
+	if (e->prev != COREMAP_NONE) {
+		coremap_array[e->prev].next = e->next;
+	} else {
+		freelist[e->order] = e->next;
+	}
+	if (e->next != COREMAP_NONE) {
+		coremap_array[e->next].prev = e->prev;
+	}
+}
 
 void
 coremap_bootstrap(void)
 {
 	uint32_t npages, size;
-	
+
 	/*
 	 * because ram_getsize will destroy its firstaddr and lastaddr before return,
 	 * we should initialize all other data structures before we call ram_getsize
@@ -27,11 +77,11 @@ coremap_bootstrap(void)
 	// find out how many physical pages in system
 	ram_getsize(&firstaddr, &lastaddr);
 	npages = (lastaddr - firstaddr) / PAGE_SIZE;
-	
+
 	size = ROUNDUP(npages*sizeof(struct coremap_entry), PAGE_SIZE);
 
 	coremap_array = (struct coremap_entry *)PADDR_TO_KVADDR(firstaddr);
-	
+
 	// current addr and number of pages
 	firstaddr += size;
 	firstpage = firstaddr / PAGE_SIZE;
@@ -42,8 +92,30 @@ coremap_bootstrap(void)
 	for (uint32_t i = 0; i < npages; i++) {
 		coremap_array[i].paddr = firstpage*PAGE_SIZE + i*PAGE_SIZE;
 		coremap_array[i].kvaddr = PADDR_TO_KVADDR(coremap_array[i].paddr);
-		coremap_array[i].sl = 0;
+		coremap_array[i].order = -1;
 		coremap_array[i].isDirty = false;
+		coremap_array[i].refcount = 0;
+		coremap_array[i].pte = NULL;
+		coremap_array[i].as = NULL;
+		coremap_array[i].swapslot = SWAP_NOSLOT;
+		coremap_array[i].referenced = false;
+		coremap_array[i].busy = false;
+		coremap_array[i].kmref = NULL;
+	}
+	coremap_nfree = npages;
+
+	for (int k = 0; k <= COREMAP_MAXORDER; k++) {
+		freelist[k] = COREMAP_NONE;
+	}
+
+	// carve the pages into the largest aligned blocks that fit
+	for (uint32_t i = 0; i < npages; ) {
+		int k = COREMAP_MAXORDER;
+		while ((i & ((1 << k) - 1)) != 0 || i + (1 << k) > npages) {
+			k--;
+		}
+		freelist_push(i, k);
+		i += 1 << k;
 	}
 
 	// initialization is done
@@ -51,55 +123,626 @@ coremap_bootstrap(void)
 	return;
 }
 
+// take a block of 2^order pages from the free lists; coremap_lock held
+static
+paddr_t
+buddy_alloc(int order)
+{
+	int k;
+
+	// smallest free block that is big enough
+	for (k = order; k <= COREMAP_MAXORDER; k++) {
+		if (freelist[k] != COREMAP_NONE) {
+			break;
+		}
+	}
+	if (k > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	uint32_t begin = freelist[k];
+	freelist_remove(begin);
+
+	// split it, giving the upper halves back
+	while (k > order) {
+		k--;
+		freelist_push(begin + (1 << k), k);
+	}
+
+	for (uint32_t j = begin; j < begin + (1 << order); j++) {
+		coremap_array[j].order = -1;
+		coremap_array[j].isDirty = true;
+		coremap_array[j].pte = NULL;
+		coremap_array[j].as = NULL;
+		coremap_array[j].swapslot = SWAP_NOSLOT;
+		coremap_array[j].referenced = false;
+		coremap_array[j].busy = false;
+	}
+	coremap_array[begin].order = order;
+	coremap_array[begin].refcount = 1;
+	coremap_nfree -= 1 << order;
+
+	return coremap_array[begin].paddr;
+}
+
+// give the block starting at index back to the free lists; coremap_lock held
+static
+void
+buddy_free(uint32_t index)
+{
+	int order = coremap_array[index].order;
+
+	KASSERT(coremap_array[index].pte == NULL);
+	// unmap the coremap
+	coremap_array[index].refcount = 0;
+	for (uint32_t i = index; i < index + (1 << order); i++) {
+		coremap_array[i].order = -1;
+		coremap_array[i].isDirty = false;
+	}
+	coremap_nfree += 1 << order;
+
+	// merge with the buddy for as long as it is free as a whole
+	while (order < COREMAP_MAXORDER) {
+		uint32_t buddy = index ^ (1 << order);
+		struct coremap_entry *b = &coremap_array[buddy];
+
+		if (buddy + (1 << order) > lastpage - firstpage ||
+		    b->isDirty || b->order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		b->order = -1;
+		if (buddy < index) {
+			index = buddy;
+		}
+		order++;
+	}
+	freelist_push(index, order);
+}
+
+/*
+ * Per-cpu page caches.
+ *
+ * Single pages, which is nearly everything (user pages, page tables,
+ * kmalloc subpages), are served from curcpu's c_pagecache without
+ * touching coremap_lock. An empty cache is refilled, and a full one
+ * drained, COREMAP_BATCH pages at a time. Pages sitting in a cache
+ * look allocated to the buddy lists.
+ */
+#define COREMAP_BATCH	(CPU_PAGECACHE_MAX / 2)
+
+static bool coremap_pcpu = true;
+
+// give back all (or half) of c's cached pages to the free lists
+static
+void
+pagecache_drain(struct cpu *c, bool all)
+{
+	unsigned keep = all ? 0 : c->c_pagecache_num / 2;
+
+	spinlock_acquire(&coremap_lock);
+	while (c->c_pagecache_num > keep) {
+		paddr_t pa = c->c_pagecache[--c->c_pagecache_num];
+		buddy_free(pa / PAGE_SIZE - firstpage);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Cross-cpu balancing: the free lists ran dry, so pull back pages the
+ * other cpus are sitting on. This is the only time a cpu touches
+ * another cpu's cache.
+ */
+static
+void
+pagecache_rebalance(bool all)
+{
+	unsigned n = cpu_count();
+
+	for (unsigned i = 0; i < n; i++) {
+		struct cpu *c = cpu_get(i);
+
+		spinlock_acquire(&c->c_pagecache_lock);
+		pagecache_drain(c, all);
+		spinlock_release(&c->c_pagecache_lock);
+	}
+}
+
+static
+paddr_t
+pagecache_alloc(void)
+{
+	struct cpu *c = curcpu->c_self;
+	paddr_t pa;
+
+	spinlock_acquire(&c->c_pagecache_lock);
+
+	if (c->c_pagecache_num == 0) {
+		spinlock_acquire(&coremap_lock);
+		while (c->c_pagecache_num < COREMAP_BATCH) {
+			pa = buddy_alloc(0);
+			if (pa == 0) {
+				break;
+			}
+			c->c_pagecache[c->c_pagecache_num++] = pa;
+		}
+		spinlock_release(&coremap_lock);
+	}
+
+	if (c->c_pagecache_num == 0) {
+		spinlock_release(&c->c_pagecache_lock);
+
+		pagecache_rebalance(false);
+
+		spinlock_acquire(&coremap_lock);
+		pa = buddy_alloc(0);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+	pa = c->c_pagecache[--c->c_pagecache_num];
+	spinlock_release(&c->c_pagecache_lock);
+	return pa;
+}
+
+static
+void
+pagecache_free(paddr_t pa)
+{
+	struct cpu *c = curcpu->c_self;
+
+	spinlock_acquire(&c->c_pagecache_lock);
+	if (c->c_pagecache_num == CPU_PAGECACHE_MAX) {
+		pagecache_drain(c, false);
+	}
+	c->c_pagecache[c->c_pagecache_num++] = pa;
+	spinlock_release(&c->c_pagecache_lock);
+}
+
+/*
+ * Turn the per-cpu caches on or off (for benchmarking). Turning them
+ * off flushes them so every page is back on the free lists.
+ */
+void
+coremap_set_pcpu(bool enable)
+{
+	coremap_pcpu = enable;
+	if (!enable && vm_got) {
+		pagecache_rebalance(true);
+	}
+}
+
+// pages managed by the coremap, for sizing caches of other subsystems
+uint32_t
+coremap_npages(void)
+{
+	KASSERT(vm_got);
+	return lastpage - firstpage;
+}
+
+#if !OPT_DUMBVM
+/*
+ * Paging.
+ *
+ * A user page that belongs to exactly one address space remembers the
+ * PTE mapping it, which makes it evictable. The clock hand sweeps the
+ * coremap, giving every page it finds referenced a second chance. The
+ * victim is marked busy so nobody maps it again, shot out of every
+ * TLB, written to a swap slot unless it still has an identical copy in
+ * one, and finally its PTE is turned into a swap entry. Kernel pages
+ * and pages shared copy-on-write have no PTE and stay put.
+ *
+ * The pageout thread evicts ahead of demand whenever coremap_nfree
+ * falls under pageout_low, so dirty victims are normally written back
+ * in the background. A thread that still finds memory empty evicts a
+ * page itself, if it is allowed to sleep.
+ */
+
+// sleep here for busy pages
+static struct wchan *coremap_wchan;
+// one eviction at a time, and the clock hand
+static struct lock *pageout_lock;
+static uint32_t clock_hand;
+static struct wchan *pageout_wchan;
+static uint32_t pageout_low;
+static uint32_t pageout_high;
+static bool pageout_started = false;
+
+void
+coremap_lock_acquire(void)
+{
+	spinlock_acquire(&coremap_lock);
+}
+
+void
+coremap_lock_release(void)
+{
+	spinlock_release(&coremap_lock);
+}
+
+// wait for a busy page; coremap_lock held, and released
+void
+coremap_wait(void)
+{
+	wchan_lock(coremap_wchan);
+	spinlock_release(&coremap_lock);
+	wchan_sleep(coremap_wchan);
+}
+
+struct coremap_entry *
+coremap_entry(paddr_t paddr)
+{
+	KASSERT(paddr / PAGE_SIZE >= firstpage && paddr / PAGE_SIZE < lastpage);
+	return &coremap_array[paddr / PAGE_SIZE - firstpage];
+}
+
+// second chance clock; coremap_lock held
+static
+uint32_t
+clock_select(void)
+{
+	uint32_t npages = lastpage - firstpage;
+
+	// two turns: the first may only be clearing referenced bits
+	for (uint32_t i = 0; i < 2 * npages; i++) {
+		struct coremap_entry *e = &coremap_array[clock_hand];
+		uint32_t index = clock_hand;
+
+		clock_hand = (clock_hand + 1) % npages;
+		if (e->pte == NULL || e->busy) {
+			continue;
+		}
+		KASSERT(e->isDirty && e->order == 0 && e->refcount == 1);
+		if (e->referenced) {
+			e->referenced = false;
+			continue;
+		}
+		return index;
+	}
+
+	return COREMAP_NONE;
+}
+
+/*
+ * Evict one page. Returns its frame, which now belongs to the caller
+ * as if just allocated, or 0 if nothing could be evicted.
+ */
+static
+paddr_t
+coremap_evict(void)
+{
+	struct coremap_entry *e;
+	uint32_t index, slot, ehi;
+	int result;
+
+	KASSERT(lock_do_i_hold(pageout_lock));
+
+	spinlock_acquire(&coremap_lock);
+	index = clock_select();
+	if (index == COREMAP_NONE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	e = &coremap_array[index];
+	e->busy = true;
+	slot = e->swapslot;
+	ehi = as_tlbhi(e->as, e->vaddr);
+	as_stlb_invalidate(e->as, e->vaddr);
+	spinlock_release(&coremap_lock);
+
+	// nobody maps it again while busy, so get rid of existing mappings
+	vm_tlbshootdown_page(ehi);
+
+	// write it out, unless swap already has it
+	result = 0;
+	if (slot == SWAP_NOSLOT) {
+		result = swap_alloc(&slot);
+		if (result == 0) {
+			result = swap_out(slot, e->paddr);
+			if (result) {
+				swap_free(slot);
+			}
+		}
+		if (result) {
+			slot = SWAP_NOSLOT;
+		}
+	}
+
+	spinlock_acquire(&coremap_lock);
+	e->busy = false;
+	if (e->pte == NULL) {
+		// its address space went away meanwhile and left it to us
+		if (slot != SWAP_NOSLOT) {
+			swap_free(slot);
+		}
+	} else if (result) {
+		// out of swap, or a disk error; it stays where it is
+		wchan_wakeall(coremap_wchan);
+		spinlock_release(&coremap_lock);
+		return 0;
+	} else {
+		*e->pte = PTE_MKSWAP(slot) | (*e->pte & PTE_DIRTY);
+		e->pte = NULL;
+		e->as = NULL;
+	}
+	e->swapslot = SWAP_NOSLOT;
+	e->referenced = false;
+	wchan_wakeall(coremap_wchan);
+	spinlock_release(&coremap_lock);
+
+	return e->paddr;
+}
+
+// may this thread wait for the disk to free a page?
+static
+bool
+coremap_cansleep(void)
+{
+	return pageout_started && !curthread->t_in_interrupt &&
+		curthread->t_iplhigh_count == 0 &&
+		!lock_do_i_hold(pageout_lock);
+}
+
+// last resort for a single page: evict one ourselves
+static
+paddr_t
+coremap_reclaim(void)
+{
+	paddr_t addr;
+
+	lock_acquire(pageout_lock);
+
+	// the pageout thread may have freed some while we waited
+	spinlock_acquire(&coremap_lock);
+	addr = buddy_alloc(0);
+	spinlock_release(&coremap_lock);
+
+	if (addr == 0) {
+		addr = coremap_evict();
+	}
+
+	lock_release(pageout_lock);
+	return addr;
+}
+
+static
+void
+pageout_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		wchan_lock(pageout_wchan);
+		wchan_sleep(pageout_wchan);
+
+		lock_acquire(pageout_lock);
+		while (coremap_nfree < pageout_high) {
+			paddr_t pa = coremap_evict();
+			if (pa == 0) {
+				break;
+			}
+			// straight back to the free lists, not to our cpu's cache
+			spinlock_acquire(&coremap_lock);
+			buddy_free(pa / PAGE_SIZE - firstpage);
+			spinlock_release(&coremap_lock);
+		}
+		lock_release(pageout_lock);
+	}
+}
+
+/*
+ * Paging needs kmalloc, threads and the swap disk, so it starts once
+ * those are up. Without swap nothing is ever evicted.
+ */
+void
+coremap_pageout_bootstrap(void)
+{
+	uint32_t npages = lastpage - firstpage;
+	int result;
+
+	coremap_wchan = wchan_create("coremap");
+	if (coremap_wchan == NULL) {
+		panic("coremap: wchan_create failed\n");
+	}
+
+	if (!swap_enabled()) {
+		return;
+	}
+
+	pageout_lock = lock_create("pageout");
+	pageout_wchan = wchan_create("pageout");
+	if (pageout_lock == NULL || pageout_wchan == NULL) {
+		panic("coremap: out of memory starting pageout\n");
+	}
+	pageout_low = npages / 32 + 1;
+	pageout_high = npages / 16 + 2;
+	clock_hand = 0;
+
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		panic("coremap: thread_fork pageout: %s\n", strerror(result));
+	}
+	pageout_started = true;
+}
+
+// make AS's PTE map the page at PADDR, which becomes PTE's own
+void
+coremap_map(pte_t *pte, paddr_t paddr, struct addrspace *as, vaddr_t vaddr,
+	    uint32_t swapslot)
+{
+	struct coremap_entry *e = coremap_entry(paddr);
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(e->refcount == 1 && !e->busy);
+	e->pte = pte;
+	e->as = as;
+	e->vaddr = vaddr;
+	e->swapslot = swapslot;
+	e->referenced = true;
+	// a page coming back from swap is still owed to its file
+	*pte = paddr | PTE_VALID | (*pte & PTE_DIRTY);
+	spinlock_release(&coremap_lock);
+}
+
+// release whatever PTE holds, for an address space going away
+void
+coremap_unmap(pte_t *pte)
+{
+	struct coremap_entry *e;
+	pte_t entry;
+
+	spinlock_acquire(&coremap_lock);
+	entry = *pte;
+	*pte = 0;
+
+	if (entry & PTE_SWAPPED) {
+		spinlock_release(&coremap_lock);
+		swap_free(PTE_SLOT(entry));
+		return;
+	}
+	KASSERT(entry & PTE_VALID);
+
+	e = coremap_entry(entry & PTE_FRAME);
+	if (e->pte == pte) {
+		e->pte = NULL;
+		e->as = NULL;
+		if (e->busy) {
+			// coremap_evict finds it orphaned and frees it
+			spinlock_release(&coremap_lock);
+			return;
+		}
+		if (e->swapslot != SWAP_NOSLOT) {
+			swap_free(e->swapslot);
+			e->swapslot = SWAP_NOSLOT;
+		}
+		e->referenced = false;
+	}
+	spinlock_release(&coremap_lock);
+
+	coremap_free_kpages(PADDR_TO_KVADDR(entry & PTE_FRAME));
+}
+
+/*
+ * Give a forked child's NPTE the page behind its parent's OPTE. A
+ * resident page is shared, copy-on-write unless SHARED (a MAP_SHARED
+ * mapping) says both go on using the one frame. A page that is out in
+ * swap is read into a copy of the child's own, as slots are never
+ * shared, or, if SHARED, read back in for both of them.
+ */
+int
+coremap_share(pte_t *opte, pte_t *npte, struct addrspace *as, vaddr_t vaddr,
+	      bool shared)
+{
+	struct coremap_entry *e;
+	pte_t entry;
+	paddr_t paddr;
+	int result;
+
+	while (1) {
+		spinlock_acquire(&coremap_lock);
+		entry = *opte;
+		if (!(entry & PTE_VALID)) {
+			spinlock_release(&coremap_lock);
+			break;
+		}
+
+		e = coremap_entry(entry & PTE_FRAME);
+		if (e->busy) {
+			coremap_wait();
+			continue;
+		}
+		e->refcount++;
+		// shared pages belong to nobody, so they are never evicted
+		e->pte = NULL;
+		e->as = NULL;
+		if (e->swapslot != SWAP_NOSLOT) {
+			swap_free(e->swapslot);
+			e->swapslot = SWAP_NOSLOT;
+		}
+		// the parent alone writes back what it has stored so far
+		*npte = entry & ~PTE_DIRTY;
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	// only the parent itself could page it back in
+	KASSERT(entry & PTE_SWAPPED);
+	paddr = coremap_getppages(1);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	result = swap_in(PTE_SLOT(entry), paddr);
+	if (result) {
+		coremap_free_kpages(PADDR_TO_KVADDR(paddr));
+		return result;
+	}
+	if (!shared) {
+		coremap_map(npte, paddr, as, vaddr, SWAP_NOSLOT);
+		return 0;
+	}
+
+	// resident again, and belonging to nobody, like any shared page
+	spinlock_acquire(&coremap_lock);
+	e = coremap_entry(paddr);
+	KASSERT(e->refcount == 1 && e->pte == NULL);
+	e->refcount++;
+	swap_free(PTE_SLOT(entry));
+	*opte = paddr | PTE_VALID | (entry & PTE_DIRTY);
+	*npte = paddr | PTE_VALID;
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+#endif /* !OPT_DUMBVM */
+
+/*
+ * Returns 0 if no block of npages is free; callers report ENOMEM.
+ * A single page may be got by evicting a user page to swap.
+ */
 paddr_t
 coremap_getppages(unsigned long npages)
 {
 	paddr_t addr;
 	if (!vm_got) {
 		spinlock_acquire(&stealmem_lock);
-		
+
 		addr = ram_stealmem(npages);
 
 		spinlock_release(&stealmem_lock);
+	} else if (npages == 1 && coremap_pcpu) {
+		addr = pagecache_alloc();
 	} else {
-		spinlock_acquire(&coremap_lock);
+		int order;
 
-		uint32_t begin = 0;
-		uint32_t index = 0;
-		// is the page status is fixed
-		bool isFix = false;
-
-		for (uint32_t i = 0; i < lastpage-firstpage; i++) {
-			if (coremap_array[i].isDirty) {
-				begin = index = 0;
-				isFix = false;
-			} else {
-				index++;
-				
-				if (!isFix) {
-					begin = i;
-					isFix = true;
-				}
-				
-				// get pages we need
-				if (index == npages) {
-					for (uint32_t j = begin; j < begin+npages; j++) {
-						coremap_array[j].sl = npages - j + begin;
-						coremap_array[j].isDirty = true;
-					}
-
-					// got it
-					spinlock_release(&coremap_lock);
-					return coremap_array[begin].paddr;
-				}
+		// blocks come in powers of two
+		for (order = 0; (1UL << order) < npages; order++) {
+			if (order == COREMAP_MAXORDER) {
+				return 0;
 			}
 		}
 
-		// now here, it means fail to get free pages
+		spinlock_acquire(&coremap_lock);
+		addr = buddy_alloc(order);
 		spinlock_release(&coremap_lock);
-		panic("No free pages\n");
-	
+
+		if (addr == 0 && coremap_pcpu) {
+			// cached single pages may be splitting the block we need
+			pagecache_rebalance(true);
+
+			spinlock_acquire(&coremap_lock);
+			addr = buddy_alloc(order);
+			spinlock_release(&coremap_lock);
+		}
+	}
+
+#if !OPT_DUMBVM
+	if (addr == 0 && npages == 1 && coremap_cansleep()) {
+		addr = coremap_reclaim();
+	}
+	if (pageout_started && coremap_nfree < pageout_low) {
+		wchan_wakeone(pageout_wchan);
 	}
+#endif
 
 	return addr;
 }
@@ -108,20 +751,67 @@ void
 coremap_free_kpages(vaddr_t addr)
 {
 	if (vm_got) {
-		spinlock_acquire(&coremap_lock);
+		uint32_t index;
 
-		uint32_t index, size;
-		index = (addr - MIPS_KSEG0) / PAGE_SIZE - firstpage;
-		size = index + coremap_array[index].sl;
+		index = (addr - MIPS_KSEG0) / PAGE_SIZE;
+		// pages stolen before the coremap existed can never come back
+		if (index < firstpage || index >= lastpage) {
+			return;
+		}
+		index -= firstpage;
 
-		// unmap the coremap
-		for (uint32_t i = index; i < size; i++) {
-			coremap_array[i].sl = 0;
-			coremap_array[i].isDirty = false;
+		/*
+		 * Only our own reference can keep refcount at 1, so an
+		 * unshared single page may skip coremap_lock. Anything
+		 * else, including a stale read, takes the slow path.
+		 */
+		if (coremap_pcpu && coremap_array[index].order == 0 &&
+		    coremap_array[index].refcount == 1) {
+			pagecache_free(coremap_array[index].paddr);
+			return;
+		}
+
+		spinlock_acquire(&coremap_lock);
+
+		// still shared by another address space, just drop our reference
+		KASSERT(coremap_array[index].isDirty);
+		KASSERT(coremap_array[index].order >= 0);
+		KASSERT(coremap_array[index].refcount > 0);
+		if (--coremap_array[index].refcount == 0) {
+			buddy_free(index);
 		}
 
 		spinlock_release(&coremap_lock);
 	}
 
 }
+
+/*
+ * The subpage allocator keeps the pageref for each page it splits up
+ * in the page's entry, so kfree can find it from the address alone.
+ * The field belongs to kmalloc (under its own lock) for as long as the
+ * page is allocated. Pages stolen before the coremap existed have no
+ * entry: setting is a no-op and getting returns false for those.
+ */
+void
+coremap_kmalloc_set(vaddr_t addr, void *ref)
+{
+	uint32_t index = (addr - MIPS_KSEG0) / PAGE_SIZE;
+
+	if (vm_got && index >= firstpage && index < lastpage) {
+		coremap_array[index - firstpage].kmref = ref;
+	}
+}
+
+bool
+coremap_kmalloc_get(vaddr_t addr, void **ref)
+{
+	uint32_t index = (addr - MIPS_KSEG0) / PAGE_SIZE;
+
+	if (!vm_got || index < firstpage || index >= lastpage) {
+		return false;
+	}
+	*ref = coremap_array[index - firstpage].kmref;
+	return true;
+}
 #endif /* OPT_A3 */
@@ -31,6 +31,10 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <coremap.h>
+#endif /* OPT_A3 */
 
 /*
  * Kernel malloc.
@@ -117,6 +121,101 @@ struct pageref {
 
 ////////////////////////////////////////
 
+#if OPT_A3
+/*
+ * Pagerefs come in pages of them, each starting with a bitmap of which
+ * of its pagerefs are in use. Whenever they are all in use
+ * subpage_kmalloc adds another page of them, so the heap is limited
+ * only by memory rather than to 1M. Pages of pagerefs are never given
+ * back; a freed pageref finds its page by masking its address.
+ */
+
+#define INUSE_WORDS 8
+
+struct pagerefpage {
+	struct pagerefpage *next;
+	uint32_t inuse[INUSE_WORDS];
+	struct pageref refs[];
+};
+
+#define NPAGEREFS ((PAGE_SIZE - sizeof(struct pagerefpage)) / \
+		   sizeof(struct pageref))
+#define PAGEREFPAGE(pr) ((struct pagerefpage *)((vaddr_t)(pr) & PAGE_FRAME))
+
+static struct pagerefpage *pagerefpages;
+static unsigned npagerefpages;
+
+/* all the pagerefs there are, for the consistency checks */
+#define MAXPAGEREFS (npagerefpages * NPAGEREFS)
+
+/* add PAGE, fresh from alloc_kpages, as a page of free pagerefs */
+static
+void
+addpagerefs(vaddr_t page)
+{
+	struct pagerefpage *prp = (struct pagerefpage *)page;
+	unsigned i;
+
+	KASSERT(NPAGEREFS <= INUSE_WORDS*32);
+	KASSERT((page & ~PAGE_FRAME) == 0);
+
+	for (i=0; i<INUSE_WORDS; i++) {
+		prp->inuse[i] = 0;
+	}
+	/* the bits past the end of the page are never free */
+	for (i=NPAGEREFS; i<INUSE_WORDS*32; i++) {
+		prp->inuse[i/32] |= ((uint32_t)1) << (i%32);
+	}
+	prp->next = pagerefpages;
+	pagerefpages = prp;
+	npagerefpages++;
+}
+
+static
+struct pageref *
+allocpageref(void)
+{
+	struct pagerefpage *prp;
+	unsigned i,j;
+	uint32_t k;
+
+	for (prp = pagerefpages; prp != NULL; prp = prp->next) {
+		for (i=0; i<INUSE_WORDS; i++) {
+			if (prp->inuse[i]==0xffffffff) {
+				/* full */
+				continue;
+			}
+			for (k=1,j=0; k!=0; k<<=1,j++) {
+				if ((prp->inuse[i] & k)==0) {
+					prp->inuse[i] |= k;
+					return &prp->refs[i*32 + j];
+				}
+			}
+			KASSERT(0);
+		}
+	}
+
+	/* ran out */
+	return NULL;
+}
+
+static
+void
+freepageref(struct pageref *p)
+{
+	struct pagerefpage *prp;
+	size_t i, j;
+	uint32_t k;
+
+	prp = PAGEREFPAGE(p);
+	j = p-prp->refs;
+	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
+	i = j/32;
+	k = ((uint32_t)1) << (j%32);
+	KASSERT((prp->inuse[i] & k) != 0);
+	prp->inuse[i] &= ~k;
+}
+#else
 /*
  * This is cheesy. 
  *
@@ -181,6 +280,9 @@ freepageref(struct pageref *p)
 	pagerefs_inuse[i] &= ~k;
 }
 
+#define MAXPAGEREFS NPAGEREFS
+#endif /* OPT_A3 */
+
 ////////////////////////////////////////
 
 static struct pageref *sizebases[NSIZES];
@@ -260,14 +362,14 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(sc < MAXPAGEREFS);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
+		KASSERT(ac < MAXPAGEREFS);
 		ac++;
 	}
 
@@ -469,6 +571,20 @@ subpage_kmalloc(size_t sz)
 	spinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
+#if OPT_A3
+	if (pr==NULL) {
+		/* Get another page of pagerefs, also without the lock. */
+		vaddr_t prpages;
+
+		spinlock_release(&kmalloc_spinlock);
+		prpages = alloc_kpages(1);
+		spinlock_acquire(&kmalloc_spinlock);
+		if (prpages != 0) {
+			addpagerefs(prpages);
+			pr = allocpageref();
+		}
+	}
+#endif /* OPT_A3 */
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
 		spinlock_release(&kmalloc_spinlock);
@@ -503,6 +619,9 @@ subpage_kmalloc(size_t sz)
 
 	pr->next_all = allbase;
 	allbase = pr;
+#if OPT_A3
+	coremap_kmalloc_set(prpage, pr);
+#endif /* OPT_A3 */
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -519,6 +638,9 @@ subpage_kfree(void *ptr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+#if OPT_A3
+	void *ref;		// coremap's note of the pageref
+#endif /* OPT_A3 */
 
 	ptraddr = (vaddr_t)ptr;
 
@@ -526,6 +648,26 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
+#if OPT_A3
+	/*
+	 * The coremap knows the pageref of every page we got from it;
+	 * only pages from before it existed need the search below.
+	 */
+	if (coremap_kmalloc_get(ptraddr, &ref)) {
+		pr = ref;
+		if (pr == NULL) {
+			/* Not a subpage allocation */
+			spinlock_release(&kmalloc_spinlock);
+			return -1;
+		}
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+		KASSERT(prpage == (ptraddr & PAGE_FRAME));
+		KASSERT(blktype>=0 && blktype<NSIZES);
+		checksubpage(pr);
+	}
+	else
+#endif /* OPT_A3 */
 	for (pr = allbase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
 		blktype = PR_BLOCKTYPE(pr);
@@ -578,6 +720,9 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+#if OPT_A3
+		coremap_kmalloc_set(prpage, NULL);
+#endif /* OPT_A3 */
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
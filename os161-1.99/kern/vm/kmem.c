@@ -0,0 +1,329 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <kmem.h>
+
+/*
+ * Object caches; see kmem.h.
+ *
+ * A slab is one page: this header, then as many objects as fit. Its
+ * free objects are linked through their first word. Slabs with any
+ * free objects are on their cache's kc_partial list; full ones are on
+ * no list at all, as nothing needs to find them but kmem_cache_free,
+ * which has the address. One completely free slab is kept around per
+ * cache, so a cache that keeps going to zero doesn't keep going back to
+ * the page allocator; any more go back.
+ */
+struct kmem_slab {
+	struct kmem_cache *ks_cache;
+	struct kmem_slab *ks_next;	// on kc_partial
+	struct kmem_slab *ks_prev;
+	unsigned ks_nfree;
+	unsigned ks_total;
+	void *ks_free;
+};
+
+#define KMEM_KEEPEMPTY	1
+
+// where the objects start in a slab
+#define SLAB_FIRST	KMEM_ROUNDUP(sizeof(struct kmem_slab))
+
+#define OBJ_SLAB(obj)	((struct kmem_slab *)((vaddr_t)(obj) & PAGE_FRAME))
+
+// put s on the partial list; kc_lock held
+static
+void
+slab_link(struct kmem_cache *kc, struct kmem_slab *s)
+{
+	s->ks_prev = NULL;
+	s->ks_next = kc->kc_partial;
+	if (s->ks_next != NULL) {
+		s->ks_next->ks_prev = s;
+	}
+	kc->kc_partial = s;
+}
+
+// take s off the partial list; kc_lock held
+static
+void
+slab_unlink(struct kmem_cache *kc, struct kmem_slab *s)
+{
+	if (s->ks_prev != NULL) {
+		s->ks_prev->ks_next = s->ks_next;
+	} else {
+		kc->kc_partial = s->ks_next;
+	}
+	if (s->ks_next != NULL) {
+		s->ks_next->ks_prev = s->ks_prev;
+	}
+	s->ks_next = s->ks_prev = NULL;
+}
+
+// add a fresh slab to kc; called without any locks, as it may sleep
+static
+int
+slab_grow(struct kmem_cache *kc)
+{
+	struct kmem_slab *s;
+	vaddr_t page, obj;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return ENOMEM;
+	}
+
+	s = (struct kmem_slab *)page;
+	s->ks_cache = kc;
+	s->ks_total = (PAGE_SIZE - SLAB_FIRST) / kc->kc_size;
+	s->ks_nfree = s->ks_total;
+	s->ks_free = NULL;
+	for (obj = page + SLAB_FIRST + (s->ks_total - 1) * kc->kc_size;
+	     obj >= page + SLAB_FIRST; obj -= kc->kc_size) {
+		*(void **)obj = s->ks_free;
+		s->ks_free = (void *)obj;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	slab_link(kc, s);
+	kc->kc_nslabs++;
+	kc->kc_nempty++;
+	spinlock_release(&kc->kc_lock);
+	return 0;
+}
+
+// take up to n objects from kc's slabs into objs; returns how many
+static
+unsigned
+slab_take(struct kmem_cache *kc, void **objs, unsigned n)
+{
+	struct kmem_slab *s;
+	unsigned got = 0;
+
+	spinlock_acquire(&kc->kc_lock);
+	while (got < n && kc->kc_partial != NULL) {
+		s = kc->kc_partial;
+		KASSERT(s->ks_nfree > 0);
+		if (s->ks_nfree == s->ks_total) {
+			kc->kc_nempty--;
+		}
+		objs[got++] = s->ks_free;
+		s->ks_free = *(void **)s->ks_free;
+		if (--s->ks_nfree == 0) {
+			slab_unlink(kc, s);
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+	return got;
+}
+
+// give n objects back to their slabs
+static
+void
+slab_put(struct kmem_cache *kc, void **objs, unsigned n)
+{
+	struct kmem_slab *s, *dead = NULL;
+	unsigned i;
+
+	spinlock_acquire(&kc->kc_lock);
+	for (i = 0; i < n; i++) {
+		s = OBJ_SLAB(objs[i]);
+		KASSERT(s->ks_cache == kc);
+		KASSERT(s->ks_nfree < s->ks_total);
+		if (s->ks_nfree == 0) {
+			slab_link(kc, s);
+		}
+		*(void **)objs[i] = s->ks_free;
+		s->ks_free = objs[i];
+		if (++s->ks_nfree == s->ks_total) {
+			if (kc->kc_nempty < KMEM_KEEPEMPTY) {
+				kc->kc_nempty++;
+				continue;
+			}
+			slab_unlink(kc, s);
+			kc->kc_nslabs--;
+			s->ks_next = dead;
+			dead = s;
+		}
+	}
+	spinlock_release(&kc->kc_lock);
+
+	while (dead != NULL) {
+		s = dead;
+		dead = s->ks_next;
+		free_kpages((vaddr_t)s);
+	}
+}
+
+/*
+ * This cpu's magazine. Made the first time it is needed for an
+ * allocation, so freeing never has to allocate; returns NULL if there
+ * is none (or no cpu yet, early in boot), and the caller goes to the
+ * slabs directly. We may move to another cpu after looking, but the
+ * magazine has its own lock, so that only costs a little contention.
+ */
+static
+struct kmem_magazine *
+kmem_magazine(struct kmem_cache *kc, bool create)
+{
+	struct kmem_magazine *m;
+	unsigned num;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	num = curcpu->c_number;
+	KASSERT(num < KMEM_MAXCPUS);
+
+	m = kc->kc_mags[num];
+	if (m != NULL || !create) {
+		return m;
+	}
+
+	m = kmalloc(sizeof(*m));
+	if (m == NULL) {
+		return NULL;
+	}
+	spinlock_init(&m->m_lock);
+	m->m_count = 0;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_mags[num] == NULL) {
+		kc->kc_mags[num] = m;
+		m = NULL;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (m != NULL) {
+		// somebody else got there first
+		spinlock_cleanup(&m->m_lock);
+		kfree(m);
+	}
+	return kc->kc_mags[num];
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_magazine *m;
+	void *obj;
+
+	m = kmem_magazine(kc, true);
+	if (m != NULL) {
+		spinlock_acquire(&m->m_lock);
+		if (m->m_count == 0) {
+			m->m_count = slab_take(kc, m->m_objs, KMEM_MAGSIZE / 2);
+		}
+		if (m->m_count > 0) {
+			obj = m->m_objs[--m->m_count];
+			spinlock_release(&m->m_lock);
+			return obj;
+		}
+		spinlock_release(&m->m_lock);
+	}
+
+	// the slabs are all used up
+	while (slab_take(kc, &obj, 1) == 0) {
+		if (slab_grow(kc)) {
+			return NULL;
+		}
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_magazine *m;
+
+	if (obj == NULL) {
+		return;
+	}
+	KASSERT(OBJ_SLAB(obj)->ks_cache == kc);
+
+	m = kmem_magazine(kc, false);
+	if (m == NULL) {
+		slab_put(kc, &obj, 1);
+		return;
+	}
+
+	spinlock_acquire(&m->m_lock);
+	if (m->m_count == KMEM_MAGSIZE) {
+		m->m_count -= KMEM_MAGSIZE / 2;
+		slab_put(kc, &m->m_objs[m->m_count], KMEM_MAGSIZE / 2);
+	}
+	m->m_objs[m->m_count++] = obj;
+	spinlock_release(&m->m_lock);
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size)
+{
+	struct kmem_cache *kc;
+	unsigned i;
+
+	size = KMEM_ROUNDUP(size < sizeof(void *) ? sizeof(void *) : size);
+	// a slab should hold a useful number of them
+	KASSERT(size <= (PAGE_SIZE - SLAB_FIRST) / 8);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+	kc->kc_size = size;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_partial = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	for (i = 0; i < KMEM_MAXCPUS; i++) {
+		kc->kc_mags[i] = NULL;
+	}
+	return kc;
+}
+
+/*
+ * Destroy a cache made by kmem_cache_create. Every object must have
+ * been freed.
+ */
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_magazine *m;
+	struct kmem_slab *s;
+	unsigned i;
+
+	for (i = 0; i < KMEM_MAXCPUS; i++) {
+		m = kc->kc_mags[i];
+		if (m != NULL) {
+			slab_put(kc, m->m_objs, m->m_count);
+			spinlock_cleanup(&m->m_lock);
+			kfree(m);
+			kc->kc_mags[i] = NULL;
+		}
+	}
+
+	KASSERT(kc->kc_nempty == kc->kc_nslabs);
+	while ((s = kc->kc_partial) != NULL) {
+		KASSERT(s->ks_nfree == s->ks_total);
+		slab_unlink(kc, s);
+		free_kpages((vaddr_t)s);
+	}
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree((char *)kc->kc_name);
+	kfree(kc);
+}
+
+#endif /* OPT_A3 */
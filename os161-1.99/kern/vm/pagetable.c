@@ -0,0 +1,119 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <addrspace.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+
+	// second-level tables come in lazily from pt_lookup
+	for (unsigned i = 0; i < PT_L1_SIZE; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	KASSERT(pt != NULL);
+
+	for (unsigned i = 0; i < PT_L1_SIZE; i++) {
+		pte_t *l2 = pt->pt_dir[i];
+		if (l2 == NULL) {
+			continue;
+		}
+
+		// give back every frame and swap slot
+		for (unsigned j = 0; j < PT_L2_SIZE; j++) {
+			if (l2[j] != 0) {
+				coremap_unmap(&l2[j]);
+			}
+		}
+		kfree(l2);
+	}
+
+	kfree(pt);
+}
+
+/*
+ * Return the entry for VA, or NULL if there is none. With CREATE set
+ * a missing second-level table is allocated (zeroed, i.e. every entry
+ * invalid), and NULL then means we are out of memory.
+ */
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t va, bool create)
+{
+	KASSERT(va < USERSPACETOP);
+
+	pte_t **l2p = &pt->pt_dir[PT_L1_INDEX(va)];
+	if (*l2p == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		*l2p = kmalloc(PT_L2_SIZE * sizeof(pte_t));
+		if (*l2p == NULL) {
+			return NULL;
+		}
+		bzero(*l2p, PT_L2_SIZE * sizeof(pte_t));
+	}
+
+	return &(*l2p)[PT_L2_INDEX(va)];
+}
+
+/*
+ * Make NEW (which must be empty) map the same frames as OLD. Nothing
+ * is copied here: each resident frame just gains a reference, and
+ * vm_fault makes a private copy when either side first writes to it,
+ * except in MAP_SHARED regions, where both keep the one frame. Other
+ * pages that are out in swap are read back into a copy of their own,
+ * owned by NEWAS. NEWAS must already have OLD's regions.
+ */
+int
+pt_copy(struct pagetable *old, struct pagetable *new, struct addrspace *newas)
+{
+	for (unsigned i = 0; i < PT_L1_SIZE; i++) {
+		pte_t *ol2 = old->pt_dir[i];
+		if (ol2 == NULL) {
+			continue;
+		}
+
+		for (unsigned j = 0; j < PT_L2_SIZE; j++) {
+			// pages may be evicted under us, but never disappear
+			if (ol2[j] == 0) {
+				continue;
+			}
+
+			vaddr_t va = (i << PT_L1_SHIFT) | (j << PT_L2_SHIFT);
+			pte_t *npte = pt_lookup(new, va, true);
+			if (npte == NULL) {
+				return ENOMEM;
+			}
+
+			struct region *rg = as_find_region(newas, va);
+			bool shared = rg != NULL && rg->rg_shared;
+			int result = coremap_share(&ol2[j], npte, newas, va,
+						   shared);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	return 0;
+}
+
+#endif /* OPT_A3 */
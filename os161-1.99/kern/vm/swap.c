@@ -0,0 +1,142 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+static struct vnode *swap_vn = NULL;
+static uint32_t swap_nslots;
+// slot i lives at byte i*PAGE_SIZE of the disk
+static struct bitmap *swap_map;
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	struct stat st;
+	char *path;
+	int result;
+
+	path = kstrdup(SWAP_DEVICE);
+	if (path == NULL) {
+		panic("swap: out of memory\n");
+	}
+	result = vfs_open(path, O_RDWR, 0, &swap_vn);
+	kfree(path);
+	if (result) {
+		kprintf("swap: %s: %s, running without swap\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vn = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vn, &st);
+	if (result || st.st_size < PAGE_SIZE) {
+		kprintf("swap: %s is unusable, running without swap\n",
+			SWAP_DEVICE);
+		vfs_close(swap_vn);
+		swap_vn = NULL;
+		return;
+	}
+
+	swap_nslots = st.st_size / PAGE_SIZE;
+	swap_map = bitmap_create(swap_nslots);
+	if (swap_map == NULL) {
+		panic("swap: out of memory\n");
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vn != NULL;
+}
+
+int
+swap_alloc(uint32_t *slot)
+{
+	unsigned index;
+	int result;
+
+	if (swap_vn == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, &index);
+	spinlock_release(&swap_lock);
+	if (result) {
+		return result;
+	}
+
+	*slot = index;
+	return 0;
+}
+
+void
+swap_free(uint32_t slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	spinlock_release(&swap_lock);
+}
+
+static
+int
+swap_io(uint32_t slot, paddr_t paddr, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, rw);
+	if (rw == UIO_READ) {
+		result = VOP_READ(swap_vn, &u);
+	} else {
+		result = VOP_WRITE(swap_vn, &u);
+	}
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+int
+swap_in(uint32_t slot, paddr_t paddr)
+{
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	return swap_io(slot, paddr, UIO_READ);
+}
+
+int
+swap_out(uint32_t slot, paddr_t paddr)
+{
+	vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	return swap_io(slot, paddr, UIO_WRITE);
+}
+
+#endif /* OPT_A3 */
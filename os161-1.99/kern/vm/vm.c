@@ -0,0 +1,440 @@
+#include "opt-A3.h"
+
+#if OPT_A3
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+/*
+ * Demand-paged VM: user pages are allocated and zero-filled one at a
+ * time by vm_fault, the first time they are touched, and may later be
+ * evicted to swap and faulted back in from there. TLB entries carry
+ * the address space's ASID (see addrspace.c), and each address space
+ * keeps a software TLB so that refilling a lost entry is cheap.
+ */
+
+// shootdowns done by the pageout code wait on this
+static struct semaphore *vm_shootdown_sem;
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vmstats_init();
+
+	vm_shootdown_sem = sem_create("shootdown", 0);
+	if (vm_shootdown_sem == NULL) {
+		panic("vm: sem_create failed\n");
+	}
+	swap_bootstrap();
+	coremap_pageout_bootstrap();
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+
+	pa = coremap_getppages(npages);
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	coremap_free_kpages(addr);
+}
+
+// drop the entry for EHI from this cpu's TLB; interrupts off
+static
+void
+vm_tlb_invalidate(uint32_t ehi)
+{
+	int i;
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	// EHI may belong to another address space than the one running
+	tlb_setasid(curcpu->c_asid << TLBHI_PID_SHIFT);
+}
+
+/*
+ * Only the thread holding pageout_lock shoots pages down, so no cpu
+ * ever has more than one request queued and the queue cannot overflow
+ * into a flush-everything request, which could not tell its waiter.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	panic("vm: lost a tlb shootdown\n");
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	int spl;
+
+	spl = splhigh();
+	vm_tlb_invalidate(ts->ts_vaddr);
+	splx(spl);
+
+	V(ts->ts_done);
+}
+
+void
+vm_tlbshootdown_page(uint32_t ehi)
+{
+	struct tlbshootdown ts;
+	unsigned i, n, sent;
+	int spl;
+
+	ts.ts_addrspace = NULL;
+	ts.ts_vaddr = ehi;
+	ts.ts_done = vm_shootdown_sem;
+
+	// stay on this cpu until all the others have been told
+	spl = splhigh();
+	vm_tlb_invalidate(ehi);
+	n = cpu_count();
+	sent = 0;
+	for (i = 0; i < n; i++) {
+		struct cpu *c = cpu_get(i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, &ts);
+			sent++;
+		}
+	}
+	splx(spl);
+
+	while (sent-- > 0) {
+		P(vm_shootdown_sem);
+	}
+}
+
+/*
+ * Load a translation for the running address space into the TLB. If
+ * the page is already there (a write to a copy-on-write page) overwrite
+ * it, as the hardware must never see two entries for the same page.
+ * Otherwise take the next slot never used since the last flush; once
+ * there are none, let the hardware pick a victim.
+ */
+static
+void
+vm_tlb_load(uint32_t ehi, uint32_t elo)
+{
+	int i, spl;
+
+	KASSERT((ehi & TLBHI_PID) >> TLBHI_PID_SHIFT == curcpu->c_asid);
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		tlb_write(ehi, elo, i);
+		splx(spl);
+		return;
+	}
+
+	if (curcpu->c_tlb_next < NUM_TLB) {
+		tlb_write(ehi, elo, curcpu->c_tlb_next++);
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		splx(spl);
+		return;
+	}
+
+	tlb_random(ehi, elo);
+	vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	splx(spl);
+}
+
+/*
+ * Refill the TLB from the software TLB, if it has the page. This runs
+ * with interrupts off: coremap_evict clears the entry before shooting
+ * the page down, so the shootdown cannot get here between our reading
+ * the entry and loading it.
+ */
+static
+bool
+vm_stlb_refill(struct addrspace *as, vaddr_t va)
+{
+	struct stlb_entry *st = &as->as_stlb[AS_STLB_INDEX(va)];
+	int spl;
+
+	spl = splhigh();
+	if (st->st_elo == 0 || st->st_vaddr != va) {
+		splx(spl);
+		return false;
+	}
+	vm_tlb_load(as_tlbhi(as, va), st->st_elo);
+	splx(spl);
+	return true;
+}
+
+/*
+ * Give this address space its own copy of a page it shares with
+ * another one, so that it can be written. Our reference keeps the
+ * shared frame from going anywhere while we copy it.
+ */
+static
+int
+vm_cow_break(struct addrspace *as, pte_t *pte, paddr_t opaddr, vaddr_t va)
+{
+	vaddr_t kva = alloc_kpages(1);
+	if (kva == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)kva, (const void *)PADDR_TO_KVADDR(opaddr), PAGE_SIZE);
+	coremap_map(pte, kva - MIPS_KSEG0, as, va, SWAP_NOSLOT);
+
+	// drop our reference to the shared frame
+	free_kpages(PADDR_TO_KVADDR(opaddr));
+	return 0;
+}
+
+/*
+ * Make the page behind PTE resident: read it back from swap, or on
+ * first touch hand out a fresh frame, zeroed and filled in from the
+ * executable if it belongs to an ELF segment. Only we ever make our
+ * pages resident, so *pte can change under us only from resident to
+ * swapped.
+ */
+static
+int
+vm_pagein(struct addrspace *as, pte_t *pte, vaddr_t va, bool count)
+{
+	pte_t entry = *pte;
+	uint32_t slot = SWAP_NOSLOT;
+	vaddr_t kva;
+	int result;
+
+	if (entry & PTE_VALID) {
+		// still resident, only the TLB entry was lost
+		if (count) {
+			vmstats_inc(VMSTAT_TLB_RELOAD);
+		}
+		return 0;
+	}
+
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		return ENOMEM;
+	}
+
+	if (entry & PTE_SWAPPED) {
+		slot = PTE_SLOT(entry);
+		result = swap_in(slot, kva - MIPS_KSEG0);
+		if (result) {
+			free_kpages(kva);
+			return result;
+		}
+		if (count) {
+			vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		}
+	} else {
+		bool fromfile;
+
+		bzero((void *)kva, PAGE_SIZE);
+		result = as_fill_page(as, va, kva, &fromfile);
+		if (result) {
+			free_kpages(kva);
+			return result;
+		}
+		if (fromfile) {
+			vmstats_inc(VMSTAT_ELF_FILE_READ);
+			if (count) {
+				vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+			}
+		} else if (count) {
+			vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		}
+	}
+
+	// the copy in swap stays good until the page is written to
+	coremap_map(pte, kva - MIPS_KSEG0, as, va, slot);
+	return 0;
+}
+
+/*
+ * Bring in the page at VA of AS, without mapping it in the TLB. For
+ * as_copy, which needs every page of a MAP_SHARED region in a frame
+ * so the child can share it.
+ */
+int
+vm_populate(struct addrspace *as, vaddr_t va)
+{
+	pte_t *pte;
+
+	pte = pt_lookup(as->as_pt, va, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+	return vm_pagein(as, pte, va, false);
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	struct coremap_entry *e;
+	pte_t *pte;
+	paddr_t paddr;
+	uint32_t elo;
+	bool canwrite, write;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	// most misses are for pages mapped before, which need no page table walk
+	if (faulttype != VM_FAULT_READONLY && vm_stlb_refill(as, faultaddress)) {
+		vmstats_inc(VMSTAT_TLB_FAULT);
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+		return 0;
+	}
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+
+	canwrite = rg->rg_writeable || as->as_loading;
+	// a write to a read-only segment, kill the process
+	if (faulttype == VM_FAULT_READONLY && !canwrite) {
+		return EFAULT;
+	}
+	write = faulttype != VM_FAULT_READ && canwrite;
+
+	if (faulttype != VM_FAULT_READONLY) {
+		vmstats_inc(VMSTAT_TLB_FAULT);
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	result = vm_pagein(as, pte, faultaddress, faulttype != VM_FAULT_READONLY);
+	if (result) {
+		return result;
+	}
+
+	while (1) {
+		coremap_lock_acquire();
+		if (!(*pte & PTE_VALID)) {
+			// evicted again before we got to map it
+			coremap_lock_release();
+			result = vm_pagein(as, pte, faultaddress, false);
+			if (result) {
+				return result;
+			}
+			continue;
+		}
+
+		paddr = *pte & PTE_FRAME;
+		e = coremap_entry(paddr);
+		if (e->busy) {
+			coremap_wait();
+			continue;
+		}
+		if (write && e->refcount > 1 && !rg->rg_shared) {
+			// a write to a page still shared since fork
+			coremap_lock_release();
+			result = vm_cow_break(as, pte, paddr, faultaddress);
+			if (result) {
+				return result;
+			}
+			continue;
+		}
+		break;
+	}
+
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+
+	if (e->refcount == 1 && e->pte == NULL) {
+		// everybody else made their copy, it is ours (and evictable) again
+		e->pte = pte;
+		e->as = as;
+		e->vaddr = faultaddress;
+	}
+	if (write && e->swapslot != SWAP_NOSLOT) {
+		// the copy in swap is about to go stale
+		swap_free(e->swapslot);
+		e->swapslot = SWAP_NOSLOT;
+	}
+	e->referenced = true;
+	if (write && rg->rg_shared) {
+		// owed to the file from now on
+		*pte |= PTE_DIRTY;
+	}
+
+	/*
+	 * Copy-on-write and clean pages stay read-only until someone
+	 * writes to them. A MAP_SHARED page, even one a forked child
+	 * also maps, is writeable once this space has it marked dirty.
+	 */
+	elo = paddr | TLBLO_VALID;
+	if (canwrite && e->swapslot == SWAP_NOSLOT &&
+	    (rg->rg_shared ? (*pte & PTE_DIRTY) != 0 : e->refcount == 1)) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	// under coremap_lock, so the page cannot start being evicted first
+	vm_tlb_load(as_tlbhi(as, faultaddress), elo);
+	as->as_stlb[AS_STLB_INDEX(faultaddress)].st_vaddr = faultaddress;
+	as->as_stlb[AS_STLB_INDEX(faultaddress)].st_elo = elo;
+	coremap_lock_release();
+	return 0;
+}
+
+#endif /* OPT_A3 */
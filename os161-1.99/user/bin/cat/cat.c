@@ -38,37 +38,24 @@
 
 
 
+/* Bytes to ask the kernel to move per sendfile call. */
+#define CAT_CHUNK 65536
+
 /* Print a file that's already been opened. */
 static
 void
 docat(const char *name, int fd)
 {
-	char buf[1024];
-	int len, wr, wrtot;
+	int len;
 
 	/*
-	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * Have the kernel copy the file to stdout, without the data
+	 * coming up to user level. Zero means EOF. Less than zero
+	 * means an error occurred, reading or writing.
 	 */
-	while ((len = read(fd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(STDOUT_FILENO, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "stdout");
-			}
-			wrtot += wr;
-		}
+	while ((len = sendfile(STDOUT_FILENO, fd, NULL, CAT_CHUNK))>0) {
+		/* nothing */
 	}
-	/*
-	 * If we got a read error, print it and exit.
-	 */
 	if (len<0) {
 		err(1, "%s", name);
 	}
@@ -36,6 +36,9 @@
  */
 
 
+/* Bytes to ask the kernel to move per sendfile call. */
+#define COPY_CHUNK 65536
+
 /* Copy one file to another. */
 static
 void
@@ -43,8 +46,7 @@ copy(const char *from, const char *to)
 {
 	int fromfd;
 	int tofd;
-	char buf[1024];
-	int len, wr, wrtot;
+	int len;
 
 	/*
 	 * Open the files, and give up if they won't open
@@ -59,30 +61,15 @@ copy(const char *from, const char *to)
 	}
 
 	/*
-	 * As long as we get more than zero bytes, we haven't hit EOF.
-	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * Let the kernel move the data from one file to the other,
+	 * without it ever coming up to user level. Zero means EOF.
+	 * Less than zero means an error occurred, on either file.
 	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "%s", to);
-			}
-			wrtot += wr;
-		}
+	while ((len = sendfile(tofd, fromfd, NULL, COPY_CHUNK))>0) {
+		/* nothing */
 	}
-	/*
-	 * If we got a read error, print it and exit.
-	 */
 	if (len<0) {
-		err(1, "%s", from);
+		err(1, "%s to %s", from, to);
 	}
 
 	if (close(fromfd) < 0) {
@@ -0,0 +1,25 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get PROT_*, MAP_* and MS_* from the kernel
+ */
+#include <kern/mman.h>
+
+/* what mmap returns on error */
+#define MAP_FAILED    ((void *)-1)
+
+/*
+ * Map LEN bytes of a file, from the page-aligned OFFSET on, into the
+ * address space. The pages are read from the file as they are first
+ * touched. Stores to a MAP_SHARED mapping reach the file at msync(),
+ * munmap() or exit. ADDR is only a hint, and is ignored.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int filehandle,
+	   off_t offset);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+
+#endif /* _SYS_MMAN_H_ */
@@ -0,0 +1,18 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+#include <sys/types.h>
+
+/*
+ * Get struct iovec from the kernel
+ */
+#include <kern/iovec.h>
+
+/*
+ * Scatter/gather I/O: read into, or write from, iovcnt buffers in
+ * order, in one call. iovcnt may be at most IOV_MAX.
+ */
+int readv(int filehandle, const struct iovec *iov, int iovcnt);
+int writev(int filehandle, const struct iovec *iov, int iovcnt);
+
+#endif /* _SYS_UIO_H_ */
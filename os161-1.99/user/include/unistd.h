@@ -152,6 +152,10 @@ int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+/* readv, writev - see sys/uio.h */
+int sendfile(int outhandle, int inhandle, off_t *offset, size_t len);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
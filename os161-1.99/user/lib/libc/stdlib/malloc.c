@@ -30,10 +30,17 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * This is modelled on the kernel's kmalloc. Small requests come from
+ * pools of power-of-two sized blocks, with one free list per size, so
+ * malloc and free are O(1). When a size runs out, a fresh page is
+ * carved into blocks of that size. Each block starts with a header
+ * naming its size class; that is how free knows which list to put it
+ * back on. Pages carved up this way stay with their size.
+ *
+ * Requests too big for the largest class get whole pages. Free runs
+ * of pages are kept on a list sorted by address, so that neighbours
+ * coalesce. A run that ends at the top of the heap is given back with
+ * sbrk.
  */
 
 #include <stdlib.h>
@@ -54,91 +61,63 @@
 /*
  * malloc block header.
  *
- * mh_prevblock is the downwards offset to the previous header, 0 if this
- * is the bottom of the heap.
- *
- * mh_nextblock is the upwards offset to the next header.
- *
- * mh_pad is unused.
+ * mh_class is the block's size class, or MLARGE for a run of pages.
+ * mh_npages is the length of a run of pages, header included; it is
+ *    unused in blocks from a size class.
  * mh_inuse is 1 if the block is in use, 0 if it is free.
- * mh_magic* should always be a fixed value.
+ * mh_magic should always be MMAGIC.
  *
  * MBLOCKSIZE should equal sizeof(struct mheader) and be a power of 2.
- * MBLOCKSHIFT is the log base 2 of MBLOCKSIZE.
- * MMAGIC is the value for mh_magic*.
  */
 struct mheader {
-
 #if defined(MALLOC32)
 #define MBLOCKSIZE 8
-#define MBLOCKSHIFT 3
-#define MMAGIC 2
-	/*
-	 * 32-bit platform. size_t is 32 bits (4 bytes). 
-	 * Block size is 8 bytes.
-	 */
-	unsigned mh_prevblock:29;
-	unsigned mh_pad:1;
-	unsigned mh_magic1:2;
-
-	unsigned mh_nextblock:29;
-	unsigned mh_inuse:1;
-	unsigned mh_magic2:2;
-
 #elif defined(MALLOC64)
 #define MBLOCKSIZE 16
-#define MBLOCKSHIFT 4
-#define MMAGIC 6
-	/*
-	 * 64-bit platform. size_t is 64 bits (8 bytes)
-	 * Block size is 16 bytes.
-	 */
-	unsigned mh_prevblock:62;
-	unsigned mh_pad:1;
-	unsigned mh_magic1:3;
-
-	unsigned mh_nextblock:62;
-	unsigned mh_inuse:1;
-	unsigned mh_magic2:3;
-
 #else
 #error "please fix me"
 #endif
+	size_t mh_npages;
+	unsigned mh_class:8;
+	unsigned mh_inuse:1;
+	unsigned mh_magic:23;
 };
 
+#define MMAGIC		0x2bd0e1
+#define MLARGE		0xff
+
+/* Heap pages. Every block lies within one page, or is a run of them. */
+#define MPAGESIZE	4096
+
 /*
- * Operator macros on struct mheader.
- *
- * M_NEXT/PREVOFF:	return offset to next/previous header
- * M_NEXT/PREV:		return next/previous header
- * 
- * M_DATA:		return data pointer of a header
- * M_SIZE:		return data size of a header
- *
- * M_OK:		true if the magic values are correct
- * 
- * M_MKFIELD:		prepare a value for mh_next/prevblock.
- * 			(value should include the header size)
+ * The size classes, including the header, like kmalloc's subpage
+ * sizes. Anything bigger than the last one gets a run of pages.
  */
+static const size_t sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
 
-#define M_NEXTOFF(mh)	((size_t)(((size_t)((mh)->mh_nextblock))<<MBLOCKSHIFT))
-#define M_PREVOFF(mh)	((size_t)(((size_t)((mh)->mh_prevblock))<<MBLOCKSHIFT))
-#define M_NEXT(mh)	((struct mheader *)(((char*)(mh))+M_NEXTOFF(mh)))
-#define M_PREV(mh)	((struct mheader *)(((char*)(mh))-M_PREVOFF(mh)))
+/*
+ * A free block: its header, then (in the data area) the link. Small
+ * blocks are on their size's list. Runs of pages are on a list sorted
+ * by address.
+ */
+struct mfree {
+	struct mheader mf_header;
+	struct mfree *mf_next;
+};
 
 #define M_DATA(mh)	((void *)((mh)+1))
-#define M_SIZE(mh)	(M_NEXTOFF(mh)-MBLOCKSIZE)
-
-#define M_OK(mh)	((mh)->mh_magic1==MMAGIC && (mh)->mh_magic2==MMAGIC)
-
-#define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
+#define M_OK(mh)	((mh)->mh_magic==MMAGIC)
 
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables: the bottom and top addresses of the heap, the
+ * free lists of each size, and the free runs of pages.
  */
 static uintptr_t __heapbase, __heaptop;
+static struct mfree *__malloc_free[NSIZES];
+static struct mfree *__malloc_runs;
 
 /*
  * Setup function.
@@ -158,8 +137,8 @@ __malloc_init(void)
 	if ((MBLOCKSIZE & (MBLOCKSIZE-1))!=0) {
 		errx(1, "malloc: Internal error - MBLOCKSIZE not power of 2");
 	}
-	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
-		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
+	if (sizes[NSIZES-1] > MPAGESIZE) {
+		errx(1, "malloc: Internal error - size class bigger than a page");
 	}
 
 	/* init should only be called once. */
@@ -178,14 +157,14 @@ __malloc_init(void)
 	__heapbase = __heaptop = (uintptr_t)x;
 
 	/*
-	 * Make sure the heap base is aligned the way we want it.
-	 * (On OS/161, it will begin on a page boundary. But on 
-	 * an arbitrary Unix, it may not be, as traditionally it
+	 * Make sure the heap base is page-aligned, so blocks never
+	 * straddle pages. (On OS/161, it will begin on a page boundary.
+	 * But on an arbitrary Unix, it may not be, as traditionally it
 	 * begins at _end.)
 	 */
 
-	if (__heapbase % MBLOCKSIZE != 0) {
-		size_t adjust = MBLOCKSIZE - (__heapbase % MBLOCKSIZE);
+	if (__heapbase % MPAGESIZE != 0) {
+		size_t adjust = MPAGESIZE - (__heapbase % MPAGESIZE);
 		x = sbrk(adjust);
 		if (x==(void *)-1) {
 			err(1, "malloc: sbrk failed aligning heap base");
@@ -207,46 +186,31 @@ __malloc_init(void)
 #ifdef MALLOCDEBUG
 
 /*
- * Debugging print function to iterate and dump the entire heap.
+ * Debugging print function to dump the free lists.
  */
 static
 void
 __malloc_dump(void)
 {
-	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
+	struct mfree *mf;
+	unsigned i, n;
 
 	warnx("heap: ************************************************");
-
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
+	warnx("heap: 0x%lx - 0x%lx",
+	      (unsigned long) __heapbase, (unsigned long) __heaptop);
+	for (i=0; i<NSIZES; i++) {
+		n = 0;
+		for (mf = __malloc_free[i]; mf != NULL; mf = mf->mf_next) {
+			n++;
 		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i, 
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		warnx("heap: 0x%lx 0x%-6lx (next: 0x%lx) %s",
-		      (unsigned long) i + MBLOCKSIZE,
-		      (unsigned long) M_SIZE(mh),
-		      (unsigned long) (i+M_NEXTOFF(mh)),
-		      mh->mh_inuse ? "INUSE" : "FREE");
+		warnx("heap: size %-4lu: %u free",
+		      (unsigned long) sizes[i], n);
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+	for (mf = __malloc_runs; mf != NULL; mf = mf->mf_next) {
+		warnx("heap: 0x%lx %lu free pages",
+		      (unsigned long) (uintptr_t) mf,
+		      (unsigned long) mf->mf_header.mh_npages);
 	}
-
 	warnx("heap: ************************************************");
 }
 
@@ -264,6 +228,11 @@ __malloc_sbrk(size_t size)
 {
 	void *x;
 
+	/* sbrk takes an int; don't let a huge size turn into a shrink */
+	if ((int)size < 0 || (size_t)(int)size != size) {
+		return NULL;
+	}
+
 	x = sbrk(size);
 	if (x == (void *)-1) {
 		return NULL;
@@ -280,50 +249,127 @@ __malloc_sbrk(size_t size)
 }
 
 /*
- * Make a new (free) block from the block passed in, leaving size
- * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
- *
- * Only split if the excess space is at least twice the blocksize -
- * one blocksize to hold a header and one for data.
+ * Get a run of npages pages: first fit from the free runs, else from
+ * the top of the heap. A bigger free run gives up its tail, so it
+ * stays where it is on the list.
  */
 static
-void
-__malloc_split(struct mheader *mh, size_t size)
+struct mheader *
+__malloc_getpages(size_t npages)
 {
-	struct mheader *mhnext, *mhnew;
-	size_t oldsize;
+	struct mfree **mfp, *mf;
+	struct mheader *mh;
 
-	if (size % MBLOCKSIZE != 0) {
-		errx(1, "malloc: Internal error (size %lu passed to split)",
-		     (unsigned long) size);
+	for (mfp = &__malloc_runs; *mfp != NULL; mfp = &(*mfp)->mf_next) {
+		mf = *mfp;
+		if (mf->mf_header.mh_npages < npages) {
+			continue;
+		}
+		if (mf->mf_header.mh_npages == npages) {
+			*mfp = mf->mf_next;
+			mh = &mf->mf_header;
+		}
+		else {
+			mf->mf_header.mh_npages -= npages;
+			mh = (struct mheader *)((char *)mf +
+				mf->mf_header.mh_npages * MPAGESIZE);
+		}
+		mh->mh_npages = npages;
+		return mh;
 	}
 
-	if (M_SIZE(mh) - size < 2*MBLOCKSIZE) {
-		/* no room */
-		return;
+	mh = __malloc_sbrk(npages * MPAGESIZE);
+	if (mh == NULL) {
+		return NULL;
+	}
+	mh->mh_npages = npages;
+	return mh;
+}
+
+/*
+ * Put the run of pages at mh back on the free runs, merging it with
+ * the runs on either side. If it ends up at the top of the heap, give
+ * it back to the system instead.
+ */
+static
+void
+__malloc_putpages(struct mheader *mh)
+{
+	struct mfree **mfp, *mf, *prev;
+	size_t npages = mh->mh_npages;
+
+	mf = (struct mfree *)mh;
+	mf->mf_header.mh_class = MLARGE;
+	mf->mf_header.mh_inuse = 0;
+	mf->mf_header.mh_magic = MMAGIC;
+
+	prev = NULL;
+	for (mfp = &__malloc_runs; *mfp != NULL && *mfp < mf;
+	     mfp = &(*mfp)->mf_next) {
+		prev = *mfp;
+	}
+	mf->mf_next = *mfp;
+	*mfp = mf;
+
+	/* merge with the run above */
+	if (mf->mf_next != NULL &&
+	    (char *)mf + npages * MPAGESIZE == (char *)mf->mf_next) {
+		mf->mf_header.mh_npages += mf->mf_next->mf_header.mh_npages;
+		mf->mf_next = mf->mf_next->mf_next;
 	}
 
-	mhnext = M_NEXT(mh);
+	/* and with the one below */
+	if (prev != NULL && (char *)prev +
+	    prev->mf_header.mh_npages * MPAGESIZE == (char *)mf) {
+		prev->mf_header.mh_npages += mf->mf_header.mh_npages;
+		prev->mf_next = mf->mf_next;
+		mf = prev;
+	}
 
-	oldsize = M_SIZE(mh);
-	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
-	
-	mhnew = M_NEXT(mh);
-	if (mhnew==mhnext) {
-		errx(1, "malloc: Internal error (split screwed up?)");
+	/* the last run may be the top of the heap */
+	if (mf->mf_next == NULL && (uintptr_t)mf +
+	    mf->mf_header.mh_npages * MPAGESIZE == __heaptop) {
+		size_t size = mf->mf_header.mh_npages * MPAGESIZE;
+
+		if (sbrk(-(intptr_t)size) != (void *)-1) {
+			if (prev == mf) {
+				/* find what is now the last run */
+				for (mfp = &__malloc_runs; *mfp != mf;
+				     mfp = &(*mfp)->mf_next);
+			}
+			*mfp = NULL;
+			__heaptop -= size;
+		}
 	}
+}
 
-	mhnew->mh_prevblock = M_MKFIELD(size + MBLOCKSIZE);
-	mhnew->mh_pad = 0;
-	mhnew->mh_magic1 = MMAGIC;
-	mhnew->mh_nextblock = M_MKFIELD(oldsize - size);
-	mhnew->mh_inuse = 0;
-	mhnew->mh_magic2 = MMAGIC;
+/*
+ * Carve a fresh page into blocks of size class c and put them all on
+ * its free list.
+ */
+static
+int
+__malloc_refill(unsigned c)
+{
+	struct mheader *mh;
+	struct mfree *mf;
+	size_t off;
 
-	if (mhnext != (struct mheader *) __heaptop) {
-		mhnext->mh_prevblock = mhnew->mh_nextblock;
+	mh = __malloc_getpages(1);
+	if (mh == NULL) {
+		return -1;
 	}
+
+	for (off = 0; off < MPAGESIZE; off += sizes[c]) {
+		mf = (struct mfree *)((char *)mh + off);
+		mf->mf_header.mh_npages = 0;
+		mf->mf_header.mh_class = c;
+		mf->mf_header.mh_inuse = 0;
+		mf->mf_header.mh_magic = MMAGIC;
+		mf->mf_next = __malloc_free[c];
+		__malloc_free[c] = mf;
+	}
+	return 0;
 }
 
 /*
@@ -333,8 +379,9 @@ void *
 malloc(size_t size)
 {
 	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
+	struct mfree *mf;
+	size_t need;
+	unsigned c;
 
 	if (__heapbase==0) {
 		__malloc_init();
@@ -345,83 +392,45 @@ malloc(size_t size)
 		     (unsigned long) __heapbase, (unsigned long) __heaptop);
 	}
 
-#ifdef MALLOCDEBUG
-	warnx("malloc: about to allocate %lu (0x%lx) bytes", 
-	      (unsigned long) size, (unsigned long) size);
-	__malloc_dump();
-#endif
-
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
-	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
-	 */
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i, 
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
+	/* Room for the header, and for the free list link once freed. */
+	if (size > (size_t)-1 - 2*MPAGESIZE) {
+		return NULL;
+	}
+	need = MBLOCKSIZE + (size < sizeof(struct mfree *) ?
+			     sizeof(struct mfree *) : size);
 
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
+	for (c = 0; c < NSIZES; c++) {
+		if (sizes[c] >= need) {
+			break;
 		}
+	}
 
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
+	if (c == NSIZES) {
+		mh = __malloc_getpages((need + MPAGESIZE - 1) / MPAGESIZE);
+		if (mh == NULL) {
+			return NULL;
 		}
-
-		/* Try splitting block. */
-		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
+		mh->mh_class = MLARGE;
 		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
-	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+		mh->mh_magic = MMAGIC;
 	}
-
-	/*
-	 * Didn't find anything. Expand the heap.
-	 */
-
-	mh = __malloc_sbrk(size + MBLOCKSIZE);
-	if (mh == NULL) {
-		return NULL;
+	else {
+		if (__malloc_free[c] == NULL && __malloc_refill(c)) {
+			return NULL;
+		}
+		mf = __malloc_free[c];
+		__malloc_free[c] = mf->mf_next;
+		mh = &mf->mf_header;
+		if (!M_OK(mh) || mh->mh_inuse || mh->mh_class != c) {
+			errx(1, "malloc: Heap corrupt; free block at %p"
+			     " has a bad header", mh);
+		}
+		mh->mh_inuse = 1;
 	}
 
-	mh->mh_prevblock = rightprevblock;
-	mh->mh_magic1 = MMAGIC;
-	mh->mh_magic2 = MMAGIC;
-	mh->mh_pad = 0;
-	mh->mh_inuse = 1;
-	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
-
 #ifdef MALLOCDEBUG
-	warnx("malloc: allocating at %p", M_DATA(mh));
+	warnx("malloc: allocating %lu at %p", (unsigned long) size,
+	      M_DATA(mh));
 	__malloc_dump();
 #endif
 	return M_DATA(mh);
@@ -429,6 +438,7 @@ malloc(size_t size)
 
 ////////////////////////////////////////////////////////////
 
+#ifdef MALLOCDEBUG
 /*
  * Clear a range of memory with 0xdeadbeef.
  * ptr must be suitably aligned.
@@ -443,37 +453,7 @@ __malloc_deadbeef(void *ptr, size_t size)
 		x[i] = 0xdeadbeef;
 	}
 }
-
-/*
- * Attempt to merge two adjacent blocks (mh below mhnext).
- */
-static
-void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
-{
-	struct mheader *mhnextnext;
-
-	if (mh->mh_nextblock != mhnext->mh_prevblock) {
-		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
-		     mh, mhnext);
-	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
-	}
-
-	mhnextnext = M_NEXT(mhnext);
-
-	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
-				     MBLOCKSIZE + M_SIZE(mhnext));
-
-	if (mhnextnext != (struct mheader *)__heaptop) {
-		mhnextnext->mh_prevblock = mh->mh_nextblock;
-	}
-
-	/* Deadbeef out the memory used by the now-obsolete header */
-	__malloc_deadbeef(mhnext, sizeof(struct mheader));
-}
+#endif /* MALLOCDEBUG */
 
 /*
  * The actual free() implementation.
@@ -481,7 +461,8 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 void
 free(void *x)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	struct mheader *mh;
+	struct mfree *mf;
 
 	if (x==NULL) {
 		/* safest practice */
@@ -496,17 +477,13 @@ free(void *x)
 	}
 
 	/* Don't allow freeing pointers that aren't on the heap. */
-	if ((uintptr_t)x < __heapbase || (uintptr_t)x >= __heaptop) {
+	if ((uintptr_t)x < __heapbase || (uintptr_t)x >= __heaptop ||
+	    (uintptr_t)x % MBLOCKSIZE != 0) {
 		errx(1, "free: Invalid pointer %p freed (out of range)", x);
 	}
 
-#ifdef MALLOCDEBUG
-	warnx("free: about to free %p", x);
-	__malloc_dump();
-#endif
-
 	mh = ((struct mheader *)x)-1;
-	if (!M_OK(mh)) {
+	if (!M_OK(mh) || (mh->mh_class != MLARGE && mh->mh_class >= NSIZES)) {
 		errx(1, "free: Invalid pointer %p freed (corrupt header)", x);
 	}
 
@@ -514,22 +491,22 @@ free(void *x)
 		errx(1, "free: Invalid pointer %p freed (already free)", x);
 	}
 
-	/* mark it free */
-	mh->mh_inuse = 0;
-
-	/* wipe it */
-	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+#ifdef MALLOCDEBUG
+	warnx("free: about to free %p", x);
+	__malloc_deadbeef(x, mh->mh_class == MLARGE ?
+			  mh->mh_npages * MPAGESIZE - MBLOCKSIZE :
+			  sizes[mh->mh_class] - MBLOCKSIZE);
+#endif
 
-	/* Try merging with the block above (but not if we're at the top) */
-	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
+	if (mh->mh_class == MLARGE) {
+		__malloc_putpages(mh);
 	}
-
-	/* Try merging with the block below (but not if we're at the bottom) */
-	if (mh != (struct mheader *)__heapbase) {
-		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+	else {
+		/* mark it free, and put it back on its list */
+		mh->mh_inuse = 0;
+		mf = (struct mfree *)mh;
+		mf->mf_next = __malloc_free[mh->mh_class];
+		__malloc_free[mh->mh_class] = mf;
 	}
 
 #ifdef MALLOCDEBUG
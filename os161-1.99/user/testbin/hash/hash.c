@@ -36,11 +36,14 @@
  * testing your file system code.
  *
  * This should really be replaced with a real hash, like MD5 or SHA-1.
+ *
+ * The file is mmap()ed rather than read a byte at a time.
  */
 
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <err.h>
 
 #ifdef HOST
@@ -53,7 +56,8 @@ int
 main(int argc, char *argv[])
 {
 	int fd;
-	char readbuf[1];
+	const char *buf;
+	off_t size, i;
 	int j = 0;
 
 #ifdef HOST
@@ -70,9 +74,20 @@ main(int argc, char *argv[])
 		err(1, "%s", argv[1]);
 	}
 
-	for (;;) {
-		if (read(fd, readbuf, 1) <= 0) break;
-		j = ((j*8) + (int) readbuf[0]) % HASHP;
+	size = lseek(fd, 0, SEEK_END);
+	if (size < 0) {
+		err(1, "%s: lseek", argv[1]);
+	}
+
+	if (size > 0) {
+		buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED) {
+			err(1, "%s: mmap", argv[1]);
+		}
+		for (i = 0; i < size; i++) {
+			j = ((j*8) + (int) buf[i]) % HASHP;
+		}
+		munmap((void *)buf, size);
 	}
 
 	close(fd);
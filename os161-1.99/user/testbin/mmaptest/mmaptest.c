@@ -0,0 +1,190 @@
+/*
+ * mmaptest.c
+ *
+ *	Tests that stores to a MAP_SHARED mapping reach the file: at
+ *	msync, at munmap, and from a forked child, which shares the
+ *	mapping's pages with its parent, whether or not they had been
+ *	touched before the fork. Also checks that msync on an unmapped
+ *	range and mmap with unknown protection bits fail.
+ *
+ *	Makes (and removes) a test file in the current directory.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define TESTFILE "mmaptest.dat"
+#define PAGE 4096
+/* not a whole number of pages, so the last page is partly file */
+#define FILESIZE (3 * PAGE + 100)
+/* the page the parent stores to after forking, untouched until then */
+#define PARENTPAGE 2
+/* how long the child waits to see that store, in seconds */
+#define WAITSECS 10
+
+static char buf[FILESIZE];
+
+/* what byte I of the file should be after pass PASS */
+static
+char
+pattern(int pass, int i)
+{
+	return 'a' + (i * 7 + pass * 3) % 26;
+}
+
+static
+void
+fill(char *p, int pass)
+{
+	int i;
+
+	for (i = 0; i < FILESIZE; i++) {
+		p[i] = pattern(pass, i);
+	}
+}
+
+/* read the file back with read() and compare it against PASS */
+static
+void
+check(int fd, int pass, const char *when)
+{
+	int i, r, got;
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		err(1, "%s: lseek", TESTFILE);
+	}
+	for (got = 0; got < FILESIZE; got += r) {
+		r = read(fd, buf + got, FILESIZE - got);
+		if (r < 0) {
+			err(1, "%s: read", TESTFILE);
+		}
+		if (r == 0) {
+			errx(1, "%s: short file after %s (%d bytes)",
+			     TESTFILE, when, got);
+		}
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if (buf[i] != pattern(pass, i)) {
+			errx(1, "%s: byte %d wrong after %s", TESTFILE, i,
+			     when);
+		}
+	}
+}
+
+static
+char *
+map(int fd)
+{
+	char *p;
+
+	p = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "%s: mmap", TESTFILE);
+	}
+	return p;
+}
+
+int
+main(void)
+{
+	char *p;
+	int fd, i, status;
+	pid_t pid;
+
+	fd = open(TESTFILE, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open", TESTFILE);
+	}
+	fill(buf, 0);
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", TESTFILE);
+	}
+
+	/* stores, then msync */
+	p = map(fd);
+	fill(p, 1);
+	if (msync(p, FILESIZE, MS_SYNC) < 0) {
+		err(1, "msync");
+	}
+	check(fd, 1, "msync");
+
+	/* stores, then munmap */
+	fill(p, 2);
+	if (munmap(p, FILESIZE) < 0) {
+		err(1, "munmap");
+	}
+	check(fd, 2, "munmap");
+
+	/*
+	 * Parent and child each store to pages the other then has to
+	 * see, without any writeback in between. Only page 0 has been
+	 * touched when we fork; the parent's page is first touched by
+	 * its store after the fork, and the child waits for that.
+	 */
+	p = map(fd);
+	if (p[0] != pattern(2, 0)) {
+		errx(1, "mapping does not match the file");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		time_t start = time(NULL);
+		int last = PARENTPAGE * PAGE + PAGE - 1;
+
+		while (((volatile char *)p)[last] != pattern(3, last)) {
+			if (time(NULL) - start > WAITSECS) {
+				_exit(1);
+			}
+		}
+		for (i = 0; i < FILESIZE; i++) {
+			if (i / PAGE != PARENTPAGE) {
+				p[i] = pattern(3, i);
+			}
+		}
+		_exit(0);
+	}
+	for (i = PARENTPAGE * PAGE; i < (PARENTPAGE + 1) * PAGE; i++) {
+		p[i] = pattern(3, i);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child does not see the parent's stores");
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if (p[i] != pattern(3, i)) {
+			errx(1, "parent does not see the child's stores");
+		}
+	}
+	check(fd, 3, "child exit");
+	if (munmap(p, FILESIZE) < 0) {
+		err(1, "munmap");
+	}
+
+	/* things that should fail */
+	if (msync(p, FILESIZE, MS_SYNC) == 0 || errno != ENOMEM) {
+		errx(1, "msync of an unmapped range did not fail with ENOMEM");
+	}
+	if (mmap(NULL, FILESIZE, PROT_READ | 0x100, MAP_SHARED, fd, 0)
+	    != MAP_FAILED || errno != EINVAL) {
+		errx(1, "mmap with bad protection did not fail with EINVAL");
+	}
+
+	close(fd);
+	if (remove(TESTFILE) < 0) {
+		err(1, "%s: remove", TESTFILE);
+	}
+	printf("mmaptest: passed\n");
+	return 0;
+}